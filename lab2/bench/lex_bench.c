@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../include/lexer.h"
+
+/*
+ * Tokenizer benchmark and fuzzer
+ *
+ * bench: time the strtok() splitting split_line used to do against the
+ *        lexer on a corpus of generated command lines
+ * fuzz:  feed random bytes to the lexer and check every word stays
+ *        inside the line, and that plain lines tokenize like strtok
+ */
+
+#define LINE_MAX_LEN 1024
+
+static const char *words[] = {
+	"ls", "-l", "cat", "grep", "-v", "foo.txt", "/usr/bin/env", "wc",
+	"echo", "record", "sort", "-n", "a", "data_2024.log", "--color=auto",
+};
+static const char *ops[] = { "|", "<", ">", ">>", "2>", "2>&1", "<<<" };
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int legacy_split(char *line)
+{
+	int n = 0;
+	for (char *t = strtok(line, " "); t; t = strtok(NULL, " "))
+		++n;
+	return n;
+}
+
+static int lex_split(char *line)
+{
+	struct lexer lx;
+	char *word;
+	int n = 0;
+	lex_init(&lx, line);
+	while (lex_next(&lx, &word) > TOK_END)
+		++n;
+	return n;
+}
+
+// space separated words and operators, valid for both parsers
+static void gen_plain(char *buf, int maxlen)
+{
+	int len = 0, n = 1 + rand() % 24;
+	buf[0] = '\0';
+	for (int i = 0; i < n; ++i) {
+		const char *w = (i && rand() % 6 == 0) ?
+					ops[rand() % (sizeof(ops) / sizeof(*ops))] :
+					words[rand() % (sizeof(words) / sizeof(*words))];
+		int wl = strlen(w);
+		if (len + wl + 2 >= maxlen)
+			break;
+		if (len)
+			buf[len++] = ' ';
+		memcpy(buf + len, w, wl + 1);
+		len += wl;
+	}
+}
+
+static void gen_random(char *buf, int maxlen)
+{
+	static const char alphabet[] = "ab2 \t'\"\\|<>&1$*";
+	int len = rand() % maxlen;
+	for (int i = 0; i < len; ++i)
+		buf[i] = rand() % 4 ? alphabet[rand() % (sizeof(alphabet) - 1)] :
+				      1 + rand() % 255;
+	buf[len] = '\0';
+}
+
+static int fuzz(long iters)
+{
+	char line[LINE_MAX_LEN], copy[LINE_MAX_LEN];
+	for (long it = 0; it < iters; ++it) {
+		if (it & 1)
+			gen_random(line, LINE_MAX_LEN);
+		else
+			gen_plain(line, LINE_MAX_LEN);
+		strcpy(copy, line);
+		size_t len = strlen(line);
+
+		struct lexer lx;
+		enum token_type type;
+		char *word;
+		int tokens = 0;
+		lex_init(&lx, line);
+		while ((type = lex_next(&lx, &word)) > TOK_END) {
+			if (type == TOK_ERROR)
+				break;
+			if (type == TOK_WORD &&
+			    (word < line || word + strlen(word) > line + len)) {
+				fprintf(stderr, "word outside line: %s\n", copy);
+				return 1;
+			}
+			if (++tokens > (int)len + 1) {
+				fprintf(stderr, "lexer does not stop: %s\n", copy);
+				return 1;
+			}
+		}
+		if (it & 1)
+			continue;
+
+		char legacy[LINE_MAX_LEN];
+		strcpy(legacy, copy);
+		strcpy(line, copy);
+		if (legacy_split(legacy) != lex_split(line)) {
+			fprintf(stderr, "token count differs: %s\n", copy);
+			return 1;
+		}
+	}
+	printf("{\"fuzz_iterations\": %ld, \"failures\": 0}\n", iters);
+	return 0;
+}
+
+static int bench(long lines)
+{
+	char *corpus = malloc(lines * LINE_MAX_LEN / 8);
+	char *work = malloc(lines * LINE_MAX_LEN / 8);
+	int *off = malloc((lines + 1) * sizeof(int));
+	long total = 0, tokens = 0;
+
+	for (long i = 0; i < lines; ++i) {
+		off[i] = total;
+		gen_plain(corpus + total, LINE_MAX_LEN / 8);
+		total += strlen(corpus + total) + 1;
+	}
+
+	double results[2];
+	int (*split[2])(char *) = { legacy_split, lex_split };
+	for (int k = 0; k < 2; ++k) {
+		memcpy(work, corpus, total);
+		double t = now();
+		tokens = 0;
+		for (long i = 0; i < lines; ++i)
+			tokens += split[k](work + off[i]);
+		results[k] = now() - t;
+	}
+	printf("{\"lines\": %ld, \"bytes\": %ld, \"tokens\": %ld, "
+	       "\"strtok_ns_per_line\": %.1f, \"lexer_ns_per_line\": %.1f}\n",
+	       lines, total, tokens, results[0] * 1e9 / lines,
+	       results[1] * 1e9 / lines);
+	free(corpus);
+	free(work);
+	free(off);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	long n = argc > 2 ? atol(argv[2]) : 1000000;
+	srand(42);
+	if (argc > 1 && strcmp(argv[1], "fuzz") == 0)
+		return fuzz(n);
+	return bench(n);
+}
@@ -0,0 +1,293 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include "../include/command.h"
+#include "../include/shell.h"
+#include "../include/expand.h"
+
+/*
+ * Shell overhead benchmark
+ *
+ * Links the shell objects and drives them directly, so every number is
+ * the cost of our own code path:
+ *   startup     fork/exec of my_shell reading "exit", to its exit
+ *   parse       split_line() + free_cmd() per line
+ *   dispatch    run_line() of a built-in: parse, expand, run in-process
+ *   spawn       spawn_proc() of /bin/true
+ *   setup       fork_cmd_node() of "true | true | ...", by stage count
+ *   throughput  "cat data | cat | ... > /dev/null", by stage count, with
+ *               default pipes and with PIPESIZE pipes, and the context
+ *               switches the bigger pipes saved (1 stage: no pipe)
+ * Results are printed as one JSON object on stdout.
+ */
+
+#define DATA_SIZE (64 << 20)
+#define TUNED_PIPE_SIZE "1M"
+
+// my_shell.c owns these in the real binary
+int history_count;
+char *history[MAX_RECORD_NUM];
+struct proc_usage history_usage[MAX_RECORD_NUM];
+
+static FILE *out;
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief Print mean, p50, p99 and min of the samples in microseconds
+ *
+ */
+static void print_stats(const char *name, double *s, int n, bool last)
+{
+	double sum = 0;
+	for (int i = 0; i < n; ++i)
+		sum += s[i];
+	qsort(s, n, sizeof(double), cmp_double);
+	fprintf(out,
+		"  \"%s\": {\"runs\": %d, \"mean_us\": %.2f, \"p50_us\": %.2f, "
+		"\"p99_us\": %.2f, \"min_us\": %.2f}%s\n",
+		name, n, sum / n * 1e6, s[n / 2] * 1e6,
+		s[(int)(n * 0.99)] * 1e6, s[0] * 1e6, last ? "" : ",");
+}
+
+static void bench_startup(const char *shell, int runs)
+{
+	double *s = (double *)malloc(runs * sizeof(double));
+	int null = open("/dev/null", O_WRONLY);
+
+	for (int i = 0; i < runs; ++i) {
+		int fd[2];
+		if (pipe(fd) < 0) {
+			perror("pipe");
+			exit(1);
+		}
+		write(fd[1], "exit\n", 5);
+		close(fd[1]);
+		double t = now();
+		pid_t pid = fork();
+		if (pid == 0) {
+			dup2(fd[0], STDIN_FILENO);
+			dup2(null, STDOUT_FILENO);
+			execl(shell, shell, (char *)NULL);
+			perror(shell);
+			_exit(127);
+		}
+		waitpid(pid, NULL, 0);
+		s[i] = now() - t;
+		close(fd[0]);
+	}
+	close(null);
+	print_stats("startup", s, runs, false);
+	free(s);
+}
+
+static void bench_parse(int iters)
+{
+	static const char *lines[] = {
+		"ls -l /usr/bin",
+		"cat foo.txt | grep -v bar | sort -n | uniq -c > out.txt",
+		"echo \"$HOME\" 'single quoted' >> log 2>&1",
+		"tr a-z A-Z <<< hello | wc -c",
+	};
+	int nlines = sizeof(lines) / sizeof(*lines);
+	char buf[BUF_SIZE];
+
+	double t = now();
+	for (int i = 0; i < iters; ++i) {
+		strcpy(buf, lines[i % nlines]);
+		struct cmd *cmd = split_line(buf);
+		free_cmd(cmd);
+	}
+	double ns = (now() - t) / iters * 1e9;
+	fprintf(out, "  \"parse\": {\"lines\": %d, \"ns_per_line\": %.1f},\n",
+		iters, ns);
+}
+
+static void bench_dispatch(int iters)
+{
+	static const char *lines[] = { "true", "echo hello world",
+				       "x=1; [ $x -eq 1 ] && true" };
+	int nlines = sizeof(lines) / sizeof(*lines);
+	char buf[BUF_SIZE];
+
+	fprintf(out, "  \"dispatch_ns_per_line\": {");
+	for (int l = 0; l < nlines; ++l) {
+		double t = now();
+		for (int i = 0; i < iters; ++i) {
+			strcpy(buf, lines[l]);
+			run_line(buf);
+		}
+		fflush(stdout);
+		fprintf(out, "\"%s\": %.1f%s", lines[l],
+			(now() - t) / iters * 1e9, l + 1 < nlines ? ", " : "");
+	}
+	fprintf(out, "},\n");
+}
+
+/**
+ * @brief Parse and expand a command once, so only execution is timed
+ *
+ */
+static struct cmd *prepare(const char *line)
+{
+	char *buf = strdup(line);
+	struct cmd *cmd = split_line(buf);
+	if (cmd == NULL || expand_cmd(cmd) < 0) {
+		fprintf(stderr, "bad bench command: %s\n", line);
+		exit(1);
+	}
+	// buf is referenced by the raw words, it lives as long as cmd
+	return cmd;
+}
+
+static void bench_spawn(int runs)
+{
+	double *s = (double *)malloc(runs * sizeof(double));
+	struct cmd *cmd = prepare("/bin/true");
+
+	for (int i = 0; i < runs; ++i) {
+		double t = now();
+		spawn_proc(cmd->head);
+		s[i] = now() - t;
+	}
+	print_stats("spawn", s, runs, false);
+	free(s);
+}
+
+static void bench_setup(int max_stages, int runs)
+{
+	char line[BUF_SIZE] = "true";
+	double *s = (double *)malloc(runs * sizeof(double));
+
+	fprintf(out, "  \"setup\": {\n");
+	for (int n = 1; n <= max_stages; ++n) {
+		if (n > 1)
+			strcat(line, " | true");
+		struct cmd *cmd = prepare(line);
+		for (int i = 0; i < runs; ++i) {
+			double t = now();
+			fork_cmd_node(cmd);
+			s[i] = now() - t;
+		}
+		char name[32];
+		snprintf(name, sizeof(name), "stages_%d", n);
+		fprintf(out, "  ");
+		print_stats(name, s, runs, n == max_stages);
+	}
+	fprintf(out, "  },\n");
+	free(s);
+}
+
+/**
+ * @brief Run the pipeline once
+ *
+ * @param csw Set to the context switches of all stages
+ * @return double
+ * Return MB/s
+ */
+static double run_throughput(struct cmd *cmd, long *csw)
+{
+	double t = now();
+	fork_cmd_node(cmd);
+	t = now() - t;
+	*csw = 0;
+	for (struct cmd_node *p = cmd->head; p; p = p->next)
+		*csw += p->usage.nvcsw + p->usage.nivcsw;
+	return DATA_SIZE / t / (1 << 20);
+}
+
+static void bench_throughput(const char *data, int max_stages)
+{
+	char line[BUF_SIZE];
+	long csw_default, csw_tuned;
+
+	fprintf(out, "  \"throughput\": {\n");
+	for (int n = 1; n <= max_stages; n *= 2) {
+		snprintf(line, sizeof(line), "cat %s", data);
+		for (int i = 1; i < n; ++i)
+			strcat(line, " | cat");
+		strcat(line, " > /dev/null");
+		struct cmd *cmd = prepare(line);
+
+		unsetenv(PIPESIZE_ENV);
+		double mbs_default = run_throughput(cmd, &csw_default);
+		long size_default = cmd->pipe_size;
+		setenv(PIPESIZE_ENV, TUNED_PIPE_SIZE, 1);
+		double mbs_tuned = run_throughput(cmd, &csw_tuned);
+		unsetenv(PIPESIZE_ENV);
+
+		// one stage has no pipe: sizes 0, nothing to save
+		char saved[32] = "null";
+		if (n > 1)
+			snprintf(saved, sizeof(saved), "%ld",
+				 csw_default - csw_tuned);
+		fprintf(out,
+			"    \"stages_%d\": {\"default_pipe\": %ld, "
+			"\"default_MBps\": %.0f, \"default_csw\": %ld, "
+			"\"tuned_pipe\": %ld, \"tuned_MBps\": %.0f, "
+			"\"tuned_csw\": %ld, \"csw_saved\": %s}%s\n",
+			n, n > 1 ? size_default : 0, mbs_default, csw_default,
+			n > 1 ? cmd->pipe_size : 0, mbs_tuned, csw_tuned, saved,
+			n * 2 <= max_stages ? "," : "");
+	}
+	fprintf(out, "  }\n");
+}
+
+int main(int argc, char *argv[])
+{
+	const char *shell = argc > 1 ? argv[1] : "./my_shell";
+	char data[] = "/tmp/shell_bench_XXXXXX";
+	char hist[] = "/tmp/shell_bench_hist_XXXXXX";
+
+	// results go to the real stdout, command output to /dev/null
+	out = fdopen(dup(STDOUT_FILENO), "w");
+	int null = open("/dev/null", O_WRONLY);
+	dup2(null, STDOUT_FILENO);
+	close(null);
+
+	// keep the user's history file out of the startup runs
+	int hfd = mkstemp(hist);
+	close(hfd);
+	setenv("MY_SHELL_HISTFILE", hist, 1);
+
+	int dfd = mkstemp(data);
+	char *block = (char *)calloc(1, 1 << 20);
+	for (int i = 0; i < DATA_SIZE >> 20; ++i)
+		write(dfd, block, 1 << 20);
+	free(block);
+	close(dfd);
+
+	for (int i = 0; i < MAX_RECORD_NUM; ++i)
+		history[i] = (char *)malloc(BUF_SIZE);
+
+	fprintf(out, "{\n");
+	bench_startup(shell, 200);
+	bench_parse(1000000);
+	bench_dispatch(200000);
+	bench_spawn(500);
+	bench_setup(8, 100);
+	bench_throughput(data, 8);
+	fprintf(out, "}\n");
+	fclose(out);
+
+	unlink(data);
+	unlink(hist);
+	return 0;
+}
@@ -0,0 +1,6 @@
+#ifndef ARITH_H
+#define ARITH_H
+
+int arith_eval(const char *expr, long *result);
+
+#endif
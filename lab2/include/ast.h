@@ -0,0 +1,64 @@
+#ifndef AST_H
+#define AST_H
+
+#include <stdbool.h>
+#include "command.h"
+
+enum ast_type {
+	AST_CMD, // pipeline, compound stages are in cmd_node->body
+	AST_LIST, // left ; right
+	AST_AND, // left && right
+	AST_OR, // left || right
+	AST_NOT, // ! left
+	AST_IF, // if left then right else alt
+	AST_WHILE, // while left do right done
+	AST_UNTIL, // until left do right done
+	AST_FOR, // for name in cmd do right done
+	AST_GROUP, // { left }
+	AST_SUBSHELL, // ( left )
+	AST_FUNC, // name() left
+};
+
+struct func_src;
+struct func;
+
+struct ast {
+	enum ast_type type;
+	struct ast *left, *right, *alt;
+	struct cmd *cmd; // AST_CMD pipeline, AST_FOR word list
+	char *name; // AST_FOR variable, AST_FUNC name
+	struct func_src *src; // AST_FUNC: the input the body belongs to
+};
+
+/* A parsed input, the words of the tree point into text */
+struct program {
+	char *text;
+	struct ast *root;
+	// defines functions: text and root are shared with their bodies
+	struct func_src *src;
+};
+
+// pending "break", "continue" or "return"
+enum flow {
+	FLOW_NONE,
+	FLOW_BREAK,
+	FLOW_CONTINUE,
+	FLOW_RETURN,
+};
+
+extern enum flow flow;
+extern int flow_count; // enclosing loops "break n" still has to leave
+extern int loop_depth, func_depth;
+// arguments of the running function, pos_args[0] is its name
+extern char **pos_args;
+extern int pos_num;
+
+int ast_parse(struct program *prog, const char *line, char *(*more)());
+void ast_free(struct ast *n);
+void program_free(struct program *prog);
+int ast_read_here_docs(struct ast *n);
+int ast_exec(struct ast *n);
+struct func *func_lookup(const char *name);
+int func_call(struct func *f, char **args);
+
+#endif
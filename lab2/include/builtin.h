@@ -12,6 +12,15 @@ int cd(char **args);
 int echo(char **args);
 int exit_shell(char **args);
 int record(char **args);
+int time_cmd(char **args);
+int timing(char **args);
+int true_cmd(char **args);
+int false_cmd(char **args);
+int test(char **args);
+int break_cmd(char **args);
+int continue_cmd(char **args);
+int return_cmd(char **args);
+int coproc(char **args);
 
 extern const char *builtin_str[];
 
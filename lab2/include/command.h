@@ -5,25 +5,59 @@
 #define BUF_SIZE 1024
 
 #include <stdbool.h>
+#include <sys/types.h>
+#include "usage.h"
+#include "lexer.h"
+
+struct ast;
 
 struct cmd_node {
+	// raw words from the lexer, still quoted, see expand_cmd()
+	char **words;
+	int words_num, words_size;
+	char *in_word, *out_word, *err_word, *here_word;
+	// expansion results, all stored in "expanded"
 	char **args;
 	int length;
-	char *in_file, *out_file;
+	char **vars; // "NAME=value" before the command
+	int vars_num;
+	char *in_file, *out_file, *err_file;
+	char *here_str; // "<<<" word with a newline
+	char *expanded;
+	bool append, err_append, err_to_out; // ">>", "2>>", "2>&1"
+	char *here_end; // "<<" delimiter
+	char *here_doc; // "<<" body, owned by the node
+	struct ast *body; // compound command stage, see ast.h
+	bool word_list; // "for" word list, no assignments
 	int in, out;
+	pid_t pid;
+	double start;
+	struct proc_usage usage;
 	struct cmd_node *next;
 };
 
 struct cmd {
 	struct cmd_node *head;
 	int pipe_num;
+	long pipe_size; // capacity of the pipes of the last run
+	bool timed; // prefixed with "time"
 };
 
 extern char *history[MAX_RECORD_NUM];
 extern int history_count;
+extern struct proc_usage history_usage[MAX_RECORD_NUM];
 
 char *read_line();
+struct cmd *new_cmd();
+struct cmd_node *new_cmd_node();
+void push_word(struct cmd_node *node, char *word);
+bool is_redirect(enum token_type type);
+int parse_redirect(struct token_stream *ts, enum token_type type,
+		   struct cmd_node *node);
+void syntax_error(struct token_stream *ts);
 struct cmd *split_line(char *);
+void free_cmd(struct cmd *);
+int read_here_docs(struct cmd *);
 void test_cmd_struct(struct cmd *);
 void test_pipe_struct(struct cmd_node *pipe);
 #endif
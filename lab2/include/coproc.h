@@ -0,0 +1,16 @@
+#ifndef COPROC_H
+#define COPROC_H
+
+#include <stddef.h>
+
+#define COPROC_BUF 65536 // longest response line
+#define COPROC_TIMEOUT_MS 10000 // default wait for a response
+
+int coproc_start(const char *name, char **argv);
+int coproc_send(const char *name, char **words);
+int coproc_recv(const char *name, int timeout_ms);
+int coproc_close(const char *name);
+void coproc_list();
+void coproc_close_all();
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef DIRCACHE_H
+#define DIRCACHE_H
+
+#include <stddef.h>
+
+#define DIRCACHE_MAX 64 // directories kept
+
+/* Sorted names of one directory, "." and ".." excluded */
+struct dir_list {
+	char **names;
+	size_t num;
+};
+
+typedef void (*glob_cb)(const char *path, void *arg);
+
+const struct dir_list *dircache_get(const char *dir);
+int dircache_glob(const char *pattern, glob_cb cb, void *arg);
+void dircache_clear();
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef EXPAND_H
+#define EXPAND_H
+
+#include "command.h"
+
+int expand_cmd(struct cmd *cmd);
+void expand_free(struct cmd_node *node);
+
+#endif
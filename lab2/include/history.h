@@ -0,0 +1,17 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define HISTFILE_ENV "MY_SHELL_HISTFILE"
+#define HISTFILE_NAME ".my_shell_history"
+
+typedef void (*history_cb)(size_t num, const char *line, size_t len);
+
+void history_init();
+void history_append(const char *line);
+long history_search(const char *pattern, bool prefix, history_cb cb);
+void history_close();
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <stdbool.h>
+
+enum token_type {
+	TOK_END,
+	TOK_WORD,
+	TOK_PIPE, // |
+	TOK_IN, // <
+	TOK_OUT, // >
+	TOK_APPEND, // >>
+	TOK_ERR, // 2>
+	TOK_ERR_APPEND, // 2>>
+	TOK_ERR_TO_OUT, // 2>&1
+	TOK_HERE_STR, // <<<
+	TOK_HERE_DOC, // <<
+	TOK_SEMI, // ;
+	TOK_NEWLINE,
+	TOK_AND, // &&
+	TOK_OR, // ||
+	TOK_LPAREN, // (
+	TOK_RPAREN, // )
+	TOK_ERROR,
+};
+
+/*
+ * The lexer rewrites the line in place and every word is NUL terminated
+ * inside the line. Quote characters and escaping backslashes are
+ * replaced by the markers below, which keeps the words the same length
+ * and tells the expansion stage what was quoted. Raw bytes 0x01-0x03 in
+ * the input are therefore reserved.
+ */
+#define CTL_ESC '\001' // the next byte is literal
+#define CTL_QUOTE '\002' // replaces '
+#define CTL_DQUOTE '\003' // replaces "
+
+struct lexer {
+	char *r; // next byte to read
+	enum token_type pending; // operator that ended the last word
+	const char *err;
+};
+
+/* One token of lookahead over the lexer, used by the parsers */
+struct token_stream {
+	struct lexer lx;
+	enum token_type type;
+	char *word;
+	bool peeked;
+};
+
+void lex_init(struct lexer *lx, char *line);
+enum token_type lex_next(struct lexer *lx, char **word);
+char *lex_skip_subst(char *p);
+char *lex_unquote(char *word);
+const char *token_name(enum token_type type);
+void ts_init(struct token_stream *ts, char *line);
+enum token_type ts_peek(struct token_stream *ts, char **word);
+enum token_type ts_next(struct token_stream *ts, char **word);
+
+#endif
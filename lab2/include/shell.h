@@ -3,9 +3,20 @@
 
 #include "command.h"
 
+#define PIPESIZE_ENV "PIPESIZE" // pipe capacity, e.g. "1M"
+
+extern int last_status;
+extern bool shell_exit;
+
+pid_t fork_proc(struct cmd_node *);
+int wait_proc(struct cmd_node *);
 int spawn_proc(struct cmd_node *);
+long pipeline_pipe_size(struct cmd *cmd);
 int fork_cmd_node(struct cmd *cmd);
-void redirection(struct cmd_node *cmd);
+int redirection(struct cmd_node *cmd);
+int run_cmd(struct cmd *cmd);
+int run_line(char *line);
+char *command_subst(char *line);
 void shell();
 
 #endif
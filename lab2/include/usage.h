@@ -0,0 +1,26 @@
+#ifndef USAGE_H
+#define USAGE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <sys/resource.h>
+
+/* Resource usage of one command, or the sum over a pipeline's stages */
+struct proc_usage {
+	int stages; // number of processes accounted, 0 if nothing collected
+	double wall, utime, stime; // seconds
+	long maxrss; // KB
+	long minflt, majflt;
+	long nvcsw, nivcsw;
+};
+
+extern bool usage_always;
+
+double usage_now();
+void usage_from_rusage(struct proc_usage *u, const struct rusage *ru);
+void usage_diff(struct proc_usage *u, const struct rusage *before,
+		const struct rusage *after);
+void usage_add(struct proc_usage *sum, const struct proc_usage *u);
+void usage_print(FILE *fp, const char *label, const struct proc_usage *u);
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef ZCOPY_H
+#define ZCOPY_H
+
+#include <sys/types.h>
+
+ssize_t zcopy_fd(int in, int out);
+int zcopy_cat(char **args);
+
+#endif
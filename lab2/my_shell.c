@@ -1,20 +1,27 @@
 #include <stdlib.h>
 #include "include/shell.h"
 #include "include/command.h"
+#include "include/history.h"
+#include "include/coproc.h"
 
 int history_count;
 char *history[MAX_RECORD_NUM];
+struct proc_usage history_usage[MAX_RECORD_NUM];
 
 int main(int argc, char *argv[])
 {
 	history_count = 0;
 	for (int i = 0; i < MAX_RECORD_NUM; ++i)
 		history[i] = (char *)malloc(BUF_SIZE * sizeof(char));
+	history_init();
 
 	shell();
 
+	coproc_close_all();
+	history_close();
+
 	for (int i = 0; i < MAX_RECORD_NUM; ++i)
 		free(history[i]);
 
-	return 0;
+	return last_status;
 }
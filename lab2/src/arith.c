@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include "../include/arith.h"
+
+/*
+ * "$(( expr ))" evaluation on long integers
+ *
+ * Precedence climbing over the C operators a loop counter needs:
+ * || && == != < <= > >= + - * / % and unary - + !, with parentheses.
+ * Names are read from the environment, an unset or empty one is 0.
+ */
+
+struct arith {
+	const char *p;
+	const char *err;
+};
+
+static long arith_expr(struct arith *a, int prec);
+
+static void skip_blanks(struct arith *a)
+{
+	while (isspace((unsigned char)*a->p))
+		++a->p;
+}
+
+static long arith_primary(struct arith *a)
+{
+	long val = 0;
+
+	skip_blanks(a);
+	if (*a->p == '(') {
+		++a->p;
+		val = arith_expr(a, 0);
+		skip_blanks(a);
+		if (*a->p != ')') {
+			a->err = "missing `)'";
+			return 0;
+		}
+		++a->p;
+		return val;
+	}
+	if (*a->p == '-' || *a->p == '+' || *a->p == '!') {
+		char op = *a->p++;
+		val = arith_primary(a);
+		return op == '-' ? -val : op == '!' ? !val : val;
+	}
+	if (isdigit((unsigned char)*a->p)) {
+		char *end;
+		val = strtol(a->p, &end, 0);
+		a->p = end;
+		return val;
+	}
+	if (*a->p == '$')
+		++a->p;
+	if (isalpha((unsigned char)*a->p) || *a->p == '_') {
+		const char *name = a->p;
+		while (isalnum((unsigned char)*a->p) || *a->p == '_')
+			++a->p;
+		char *var = strndup(name, a->p - name);
+		const char *s = getenv(var);
+		free(var);
+		if (s && *s) {
+			char *end;
+			val = strtol(s, &end, 0);
+			if (*end)
+				a->err = "value is not a number";
+		}
+		return val;
+	}
+	a->err = "operand expected";
+	return 0;
+}
+
+/**
+ * @brief Binary operator at a->p
+ *
+ * @param len Set to the operator length
+ * @return int
+ * Return its precedence, -1 if there is none
+ */
+static int binary_op(const char *p, int *len)
+{
+	static const struct {
+		const char *op;
+		int prec;
+	} ops[] = {
+		{ "||", 1 }, { "&&", 2 }, { "==", 3 }, { "!=", 3 },
+		{ "<=", 4 }, { ">=", 4 }, { "<", 4 },  { ">", 4 },
+		{ "+", 5 },  { "-", 5 },  { "*", 6 },  { "/", 6 },
+		{ "%", 6 },
+	};
+	for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); ++i) {
+		*len = strlen(ops[i].op);
+		if (strncmp(p, ops[i].op, *len) == 0)
+			return ops[i].prec;
+	}
+	return -1;
+}
+
+static long arith_expr(struct arith *a, int prec)
+{
+	long left = arith_primary(a);
+	int len, op_prec;
+
+	while (!a->err) {
+		skip_blanks(a);
+		op_prec = binary_op(a->p, &len);
+		if (op_prec < 0 || op_prec <= prec)
+			break;
+		const char *op = a->p;
+		a->p += len;
+		long right = arith_expr(a, op_prec);
+		if (a->err)
+			break;
+		switch (op[0]) {
+		case '|': left = left || right; break;
+		case '&': left = left && right; break;
+		case '=': left = left == right; break;
+		case '!': left = left != right; break;
+		case '<': left = len == 2 ? left <= right : left < right; break;
+		case '>': left = len == 2 ? left >= right : left > right; break;
+		case '+': left += right; break;
+		case '-': left -= right; break;
+		case '*': left *= right; break;
+		case '/':
+		case '%':
+			if (right == 0) {
+				a->err = "division by 0";
+				return 0;
+			}
+			left = op[0] == '/' ? left / right : left % right;
+			break;
+		}
+	}
+	return left;
+}
+
+/**
+ * @brief Evaluate an arithmetic expression
+ * 
+ * @param expr Expression, without the surrounding "$((" and "))"
+ * @param result Value
+ * @return int 
+ * Return 0, -1 on an error (already reported)
+ */
+int arith_eval(const char *expr, long *result)
+{
+	struct arith a = { .p = expr, .err = NULL };
+
+	*result = arith_expr(&a, 0);
+	skip_blanks(&a);
+	if (!a.err && *a.p)
+		a.err = "syntax error in expression";
+	if (a.err) {
+		fprintf(stderr, "%s: %s\n", expr, a.err);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,816 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../include/ast.h"
+#include "../include/lexer.h"
+#include "../include/expand.h"
+#include "../include/shell.h"
+
+/*
+ * Compound commands and functions
+ *
+ * The input is parsed once into a tree whose leaves are the same
+ * struct cmd pipelines split_line() builds. Leaves keep their raw words
+ * and are expanded again each time they run, so a loop body is never
+ * lexed or parsed again, and a function body is parsed when it is
+ * defined and reused by every call.
+ */
+
+enum flow flow = FLOW_NONE;
+int flow_count = 0;
+int loop_depth = 0, func_depth = 0;
+char **pos_args = NULL;
+int pos_num = 0;
+
+/*
+ * The text and tree of an input that defines functions. The input holds
+ * one reference until it is freed, every function defined from it one
+ * more, and a running function one while its body runs, so redefining a
+ * function frees the old input once nothing uses it
+ */
+struct func_src {
+	char *text;
+	struct ast *root;
+	int refs;
+};
+
+struct func {
+	char *name;
+	struct ast *body;
+	struct func_src *src;
+	struct func *next;
+};
+
+static struct func *funcs = NULL;
+
+struct parser {
+	struct token_stream ts;
+	bool error;
+	struct func_src *src; // allocated by the first function definition
+};
+
+// reserved words that end a list
+static const char *terminators[] = {
+	"then", "elif", "else", "fi", "do", "done", "}", NULL,
+};
+
+static struct ast *parse_list(struct parser *p);
+static struct ast *parse_compound(struct parser *p);
+
+static struct ast *new_node(enum ast_type type, struct ast *left,
+			    struct ast *right)
+{
+	struct ast *n = (struct ast *)calloc(1, sizeof(struct ast));
+	n->type = type;
+	n->left = left;
+	n->right = right;
+	return n;
+}
+
+/**
+ * @brief Stop parsing, the offending token is left peeked
+ *
+ * @return struct ast*
+ * Return NULL
+ */
+static struct ast *fail(struct parser *p)
+{
+	p->error = true;
+	return NULL;
+}
+
+static bool peek_word(struct parser *p, const char *word)
+{
+	char *w;
+	return ts_peek(&p->ts, &w) == TOK_WORD && strcmp(w, word) == 0;
+}
+
+static bool expect(struct parser *p, const char *word)
+{
+	if (!peek_word(p, word)) {
+		fail(p);
+		return false;
+	}
+	ts_next(&p->ts, NULL);
+	return true;
+}
+
+static void skip_newlines(struct parser *p)
+{
+	while (ts_peek(&p->ts, NULL) == TOK_NEWLINE)
+		ts_next(&p->ts, NULL);
+}
+
+static bool is_terminator(struct parser *p)
+{
+	char *w;
+	enum token_type type = ts_peek(&p->ts, &w);
+
+	if (type == TOK_END || type == TOK_RPAREN)
+		return true;
+	if (type != TOK_WORD)
+		return false;
+	for (int i = 0; terminators[i]; ++i)
+		if (strcmp(w, terminators[i]) == 0)
+			return true;
+	return false;
+}
+
+static bool is_compound(const char *w)
+{
+	return strcmp(w, "if") == 0 || strcmp(w, "while") == 0 ||
+	       strcmp(w, "until") == 0 || strcmp(w, "for") == 0 ||
+	       strcmp(w, "{") == 0;
+}
+
+static bool valid_name(const char *w)
+{
+	if (!isalpha((unsigned char)*w) && *w != '_')
+		return false;
+	while (isalnum((unsigned char)*w) || *w == '_')
+		++w;
+	return *w == '\0';
+}
+
+/**
+ * @brief A list that must contain at least one command
+ *
+ */
+static struct ast *parse_body(struct parser *p)
+{
+	struct ast *n = parse_list(p);
+	if (n == NULL && !p->error)
+		fail(p);
+	return n;
+}
+
+static struct ast *parse_if(struct parser *p)
+{
+	struct ast *n = new_node(AST_IF, NULL, NULL);
+
+	if (!(n->left = parse_body(p)) || !expect(p, "then") ||
+	    !(n->right = parse_body(p)))
+		goto error;
+	if (peek_word(p, "elif")) {
+		// the nested "if" consumes the "fi"
+		ts_next(&p->ts, NULL);
+		if (!(n->alt = parse_if(p)))
+			goto error;
+		return n;
+	}
+	if (peek_word(p, "else")) {
+		ts_next(&p->ts, NULL);
+		if (!(n->alt = parse_body(p)))
+			goto error;
+	}
+	if (!expect(p, "fi"))
+		goto error;
+	return n;
+
+error:
+	ast_free(n);
+	return NULL;
+}
+
+static struct ast *parse_loop(struct parser *p, enum ast_type type)
+{
+	struct ast *n = new_node(type, NULL, NULL);
+
+	if (!(n->left = parse_body(p)) || !expect(p, "do") ||
+	    !(n->right = parse_body(p)) || !expect(p, "done")) {
+		ast_free(n);
+		return NULL;
+	}
+	return n;
+}
+
+/**
+ * @brief "for name [in word...]; do list done"
+ * The words are kept in a cmd_node, so they are expanded like argv
+ * every time the loop starts. Without "in" the function's arguments
+ * are used
+ */
+static struct ast *parse_for(struct parser *p)
+{
+	char *name, *word;
+	enum token_type type;
+
+	if (ts_peek(&p->ts, &name) != TOK_WORD || !valid_name(name))
+		return fail(p);
+	ts_next(&p->ts, NULL);
+
+	struct ast *n = new_node(AST_FOR, NULL, NULL);
+	n->name = name;
+	skip_newlines(p);
+	if (peek_word(p, "in")) {
+		ts_next(&p->ts, NULL);
+		n->cmd = new_cmd();
+		n->cmd->head->word_list = true;
+		while ((type = ts_peek(&p->ts, &word)) == TOK_WORD) {
+			push_word(n->cmd->head, word);
+			ts_next(&p->ts, NULL);
+		}
+		if (type != TOK_SEMI && type != TOK_NEWLINE)
+			goto error;
+		ts_next(&p->ts, NULL);
+	} else if (ts_peek(&p->ts, NULL) == TOK_SEMI) {
+		ts_next(&p->ts, NULL);
+	}
+	skip_newlines(p);
+	if (!expect(p, "do") || !(n->right = parse_body(p)) ||
+	    !expect(p, "done"))
+		goto error;
+	return n;
+
+error:
+	fail(p);
+	ast_free(n);
+	return NULL;
+}
+
+/**
+ * @brief Parse the compound command starting with the reserved word
+ * at the head of the stream
+ *
+ */
+static struct ast *parse_compound(struct parser *p)
+{
+	char *word;
+	struct ast *n;
+
+	ts_next(&p->ts, &word);
+	if (strcmp(word, "if") == 0)
+		return parse_if(p);
+	if (strcmp(word, "while") == 0)
+		return parse_loop(p, AST_WHILE);
+	if (strcmp(word, "until") == 0)
+		return parse_loop(p, AST_UNTIL);
+	if (strcmp(word, "for") == 0)
+		return parse_for(p);
+	// "{ list }"
+	n = new_node(AST_GROUP, parse_body(p), NULL);
+	if (n->left == NULL || !expect(p, "}")) {
+		ast_free(n);
+		return NULL;
+	}
+	return n;
+}
+
+/**
+ * @brief "name() compound" or "function name [()] compound"
+ * The definition is a node of its own, the body is registered when it
+ * runs
+ */
+static struct ast *parse_func(struct parser *p, char *name)
+{
+	char *word;
+
+	if (!valid_name(name))
+		return fail(p);
+	if (ts_peek(&p->ts, NULL) == TOK_LPAREN) {
+		ts_next(&p->ts, NULL);
+		if (ts_peek(&p->ts, NULL) != TOK_RPAREN)
+			return fail(p);
+		ts_next(&p->ts, NULL);
+	}
+	skip_newlines(p);
+	if (ts_peek(&p->ts, &word) != TOK_WORD || !is_compound(word))
+		return fail(p);
+
+	struct ast *body = parse_compound(p);
+	if (body == NULL)
+		return NULL;
+	if (p->src == NULL) {
+		p->src = (struct func_src *)calloc(1, sizeof(struct func_src));
+		p->src->refs = 1;
+	}
+	struct ast *n = new_node(AST_FUNC, body, NULL);
+	n->name = name;
+	n->src = p->src;
+	return n;
+}
+
+/**
+ * @brief Parse one pipeline stage into node
+ * A compound command goes to node->body and may be followed by
+ * redirections, anything else is a simple command
+ * @param p Parser
+ * @param node Stage to fill
+ * @param func Set when the stage is a function definition
+ * @return int
+ * Return 0, -1 on a syntax error
+ */
+static int parse_command(struct parser *p, struct cmd_node *node,
+			 struct ast **func)
+{
+	char *word;
+	enum token_type type = ts_peek(&p->ts, &word);
+	bool words = true;
+
+	if (type == TOK_LPAREN) {
+		ts_next(&p->ts, NULL);
+		node->body = new_node(AST_SUBSHELL, parse_body(p), NULL);
+		if (node->body->left == NULL)
+			return -1;
+		if (ts_peek(&p->ts, NULL) != TOK_RPAREN) {
+			fail(p);
+			return -1;
+		}
+		ts_next(&p->ts, NULL);
+		words = false;
+	} else if (type == TOK_WORD && is_compound(word)) {
+		if ((node->body = parse_compound(p)) == NULL)
+			return -1;
+		words = false;
+	} else if (type == TOK_WORD && strcmp(word, "function") == 0) {
+		ts_next(&p->ts, NULL);
+		if (ts_peek(&p->ts, &word) != TOK_WORD) {
+			fail(p);
+			return -1;
+		}
+		ts_next(&p->ts, NULL);
+		*func = parse_func(p, word);
+		return *func ? 0 : -1;
+	}
+
+	while (true) {
+		type = ts_peek(&p->ts, &word);
+		if (type == TOK_WORD && words) {
+			ts_next(&p->ts, NULL);
+			push_word(node, word);
+			continue;
+		}
+		if (!is_redirect(type))
+			break;
+		ts_next(&p->ts, NULL);
+		if (parse_redirect(&p->ts, type, node) < 0) {
+			fail(p);
+			return -1;
+		}
+	}
+	if (node->body)
+		return 0;
+	if (node->words_num == 1 && type == TOK_LPAREN && !node->in_word &&
+	    !node->out_word && !node->err_word && !node->here_word &&
+	    !node->here_end) {
+		*func = parse_func(p, node->words[0]);
+		return *func ? 0 : -1;
+	}
+	if (node->words_num == 0) {
+		fail(p);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * @brief "[!] [time] command [| command]..."
+ *
+ */
+static struct ast *parse_pipeline(struct parser *p)
+{
+	bool negate = false;
+	struct ast *func = NULL;
+
+	if (peek_word(p, "!")) {
+		ts_next(&p->ts, NULL);
+		negate = true;
+	}
+	struct cmd *cmd = new_cmd();
+	struct cmd_node *node = cmd->head;
+	if (peek_word(p, "time")) {
+		ts_next(&p->ts, NULL);
+		cmd->timed = true;
+	}
+	while (true) {
+		if (parse_command(p, node, &func) < 0)
+			goto error;
+		if (func) {
+			if (node != cmd->head || negate || cmd->timed) {
+				ast_free(func);
+				fail(p);
+				goto error;
+			}
+			free_cmd(cmd);
+			return func;
+		}
+		if (ts_peek(&p->ts, NULL) != TOK_PIPE)
+			break;
+		ts_next(&p->ts, NULL);
+		skip_newlines(p);
+		node->next = new_cmd_node();
+		node = node->next;
+		cmd->pipe_num++;
+	}
+
+	struct ast *n = new_node(AST_CMD, NULL, NULL);
+	n->cmd = cmd;
+	return negate ? new_node(AST_NOT, n, NULL) : n;
+
+error:
+	free_cmd(cmd);
+	return NULL;
+}
+
+static struct ast *parse_and_or(struct parser *p)
+{
+	struct ast *left = parse_pipeline(p);
+
+	while (left) {
+		enum token_type type = ts_peek(&p->ts, NULL);
+		if (type != TOK_AND && type != TOK_OR)
+			break;
+		ts_next(&p->ts, NULL);
+		skip_newlines(p);
+		struct ast *right = parse_pipeline(p);
+		if (right == NULL) {
+			ast_free(left);
+			return NULL;
+		}
+		left = new_node(type == TOK_AND ? AST_AND : AST_OR, left, right);
+	}
+	return left;
+}
+
+/**
+ * @brief Commands separated by ';' or newlines, up to a reserved word
+ * that ends the enclosing compound command
+ * @return struct ast*
+ * Return NULL for an empty list or on a syntax error (p->error)
+ */
+static struct ast *parse_list(struct parser *p)
+{
+	struct ast *list = NULL;
+
+	skip_newlines(p);
+	while (!is_terminator(p)) {
+		struct ast *n = parse_and_or(p);
+		if (n == NULL) {
+			ast_free(list);
+			return NULL;
+		}
+		list = list ? new_node(AST_LIST, list, n) : n;
+
+		enum token_type type = ts_peek(&p->ts, NULL);
+		if (type != TOK_SEMI && type != TOK_NEWLINE)
+			break;
+		ts_next(&p->ts, NULL);
+		skip_newlines(p);
+	}
+	return list;
+}
+
+/**
+ * @brief Whether the parser stopped because the input ended early,
+ * e.g. an "if" without "fi" or an open quote
+ *
+ */
+static bool incomplete(struct parser *p)
+{
+	enum token_type type = ts_peek(&p->ts, NULL);
+	return type == TOK_END ||
+	       (type == TOK_ERROR && strncmp(p->ts.lx.err, "unterminated", 12) == 0);
+}
+
+/**
+ * @brief Parse an input into a tree
+ * When the input ends inside a compound command or a quote, more lines
+ * are joined from "more" and the whole input is parsed again
+ * @param prog Result
+ * @param line First line of the input
+ * @param more Returns the next line (malloc'ed), NULL when there is none
+ * @return int
+ * Return 0, -1 on a syntax error (already reported)
+ */
+int ast_parse(struct program *prog, const char *line, char *(*more)())
+{
+	char *src = strdup(line), *next;
+
+	while (true) {
+		struct parser p = { .error = false, .src = NULL };
+		prog->text = strdup(src);
+		ts_init(&p.ts, prog->text);
+		prog->root = parse_list(&p);
+		if (!p.error && ts_peek(&p.ts, NULL) != TOK_END) {
+			ast_free(prog->root);
+			prog->root = fail(&p);
+		}
+		if (!p.error) {
+			prog->src = p.src;
+			if (p.src) {
+				p.src->text = prog->text;
+				p.src->root = prog->root;
+			}
+			free(src);
+			return 0;
+		}
+		// nothing points to it yet
+		free(p.src);
+		if (more && incomplete(&p) && (next = more()) != NULL) {
+			size_t len = strlen(src);
+			src = (char *)realloc(src, len + strlen(next) + 2);
+			src[len] = '\n';
+			strcpy(src + len + 1, next);
+			free(next);
+			free(prog->text);
+			continue;
+		}
+		syntax_error(&p.ts);
+		free(prog->text);
+		free(src);
+		prog->text = NULL;
+		return -1;
+	}
+}
+
+void ast_free(struct ast *n)
+{
+	if (n == NULL)
+		return;
+	ast_free(n->left);
+	ast_free(n->right);
+	ast_free(n->alt);
+	if (n->cmd)
+		free_cmd(n->cmd);
+	free(n);
+}
+
+static void func_src_get(struct func_src *src)
+{
+	++src->refs;
+}
+
+static void func_src_put(struct func_src *src)
+{
+	if (--src->refs > 0)
+		return;
+	ast_free(src->root);
+	free(src->text);
+	free(src);
+}
+
+/**
+ * @brief Free a parsed input, unless a function defined in it is
+ * still reachable from the function table
+ *
+ */
+void program_free(struct program *prog)
+{
+	if (prog->src) {
+		func_src_put(prog->src);
+		return;
+	}
+	ast_free(prog->root);
+	free(prog->text);
+}
+
+/**
+ * @brief Read the here-document bodies of every pipeline in the tree
+ *
+ * @return int
+ * Return 0, -1 if the input ended before a delimiter
+ */
+int ast_read_here_docs(struct ast *n)
+{
+	if (n == NULL)
+		return 0;
+	if (n->cmd) {
+		if (read_here_docs(n->cmd) < 0)
+			return -1;
+		for (struct cmd_node *p = n->cmd->head; p; p = p->next)
+			if (ast_read_here_docs(p->body) < 0)
+				return -1;
+	}
+	if (ast_read_here_docs(n->left) < 0 ||
+	    ast_read_here_docs(n->right) < 0)
+		return -1;
+	return ast_read_here_docs(n->alt);
+}
+
+/**
+ * @brief Consume a "break" or "continue" at the end of an iteration
+ *
+ * @return bool
+ * Return true if the loop has to stop
+ */
+static bool loop_done()
+{
+	if (flow == FLOW_BREAK || flow == FLOW_CONTINUE) {
+		if (--flow_count > 0)
+			return true;
+		bool stop = flow == FLOW_BREAK;
+		flow = FLOW_NONE;
+		return stop;
+	}
+	return flow == FLOW_RETURN || shell_exit;
+}
+
+static int exec_loop(struct ast *n)
+{
+	int status = 0;
+
+	++loop_depth;
+	while (!shell_exit) {
+		int cond = ast_exec(n->left);
+		if (flow != FLOW_NONE) {
+			if (loop_done())
+				break;
+			continue;
+		}
+		if ((cond == 0) != (n->type == AST_WHILE))
+			break;
+		status = ast_exec(n->right);
+		if (loop_done())
+			break;
+	}
+	--loop_depth;
+	return last_status = status;
+}
+
+static int exec_for(struct ast *n)
+{
+	char **items, **vec = NULL, *storage = NULL;
+	int num, status = 0;
+
+	if (n->cmd) {
+		struct cmd_node *list = n->cmd->head;
+		if (expand_cmd(n->cmd) < 0)
+			return last_status = 1;
+		// take the words, a recursive call may expand the node again
+		items = list->args;
+		num = list->length;
+		vec = list->vars;
+		storage = list->expanded;
+		list->vars = list->args = NULL;
+		list->expanded = NULL;
+		list->length = 0;
+	} else {
+		items = pos_args ? pos_args + 1 : NULL;
+		num = pos_num;
+	}
+
+	++loop_depth;
+	for (int i = 0; i < num && !shell_exit; ++i) {
+		setenv(n->name, items[i], 1);
+		status = ast_exec(n->right);
+		if (loop_done())
+			break;
+	}
+	--loop_depth;
+	free(vec);
+	free(storage);
+	return last_status = status;
+}
+
+static int exec_subshell(struct ast *n)
+{
+	int status;
+
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return last_status = 1;
+	} else if (pid == 0) {
+		status = ast_exec(n->left);
+		fflush(stdout);
+		_exit(status);
+	}
+	if (waitpid(pid, &status, 0) < 0)
+		return last_status = 1;
+	if (WIFSIGNALED(status))
+		return last_status = 128 + WTERMSIG(status);
+	return last_status = WEXITSTATUS(status);
+}
+
+static void func_define(const char *name, struct ast *body,
+			struct func_src *src)
+{
+	func_src_get(src);
+	for (struct func *f = funcs; f; f = f->next) {
+		if (strcmp(f->name, name) == 0) {
+			// the old body goes with its input, unless still used
+			func_src_put(f->src);
+			f->body = body;
+			f->src = src;
+			return;
+		}
+	}
+	struct func *f = (struct func *)malloc(sizeof(struct func));
+	f->name = strdup(name);
+	f->body = body;
+	f->src = src;
+	f->next = funcs;
+	funcs = f;
+}
+
+struct func *func_lookup(const char *name)
+{
+	for (struct func *f = funcs; f; f = f->next)
+		if (strcmp(f->name, name) == 0)
+			return f;
+	return NULL;
+}
+
+/**
+ * @brief Run a function with args as $0, $1, ...
+ * The arguments are copied, the calling node may be expanded again
+ * while the body runs, and the body is held: it may redefine itself
+ * @param f Function
+ * @param args Expanded argv of the call
+ * @return int
+ * Return the exit code
+ */
+int func_call(struct func *f, char **args)
+{
+	struct ast *body = f->body;
+	struct func_src *src = f->src;
+	char **saved_args = pos_args;
+	int saved_num = pos_num, argc = 0;
+
+	func_src_get(src);
+
+	while (args[argc])
+		++argc;
+	pos_args = (char **)malloc((argc + 1) * sizeof(char *));
+	for (int i = 0; i < argc; ++i)
+		pos_args[i] = strdup(args[i]);
+	pos_args[argc] = NULL;
+	pos_num = argc - 1;
+
+	++func_depth;
+	int status = ast_exec(body);
+	if (flow == FLOW_RETURN) {
+		flow = FLOW_NONE;
+		status = last_status;
+	}
+	--func_depth;
+
+	for (int i = 0; i < argc; ++i)
+		free(pos_args[i]);
+	free(pos_args);
+	pos_args = saved_args;
+	pos_num = saved_num;
+	func_src_put(src);
+	return last_status = status;
+}
+
+/**
+ * @brief Execute a tree
+ * Pipelines go through run_cmd(), so single built-in commands stay in
+ * the shell process and a loop of built-ins never forks
+ * @param n Tree
+ * @return int
+ * Return the exit code, also kept in last_status
+ */
+int ast_exec(struct ast *n)
+{
+	int status;
+
+	if (n == NULL || shell_exit)
+		return last_status;
+	switch (n->type) {
+	case AST_CMD:
+		return run_cmd(n->cmd);
+	case AST_LIST:
+		ast_exec(n->left);
+		if (flow != FLOW_NONE || shell_exit)
+			return last_status;
+		return ast_exec(n->right);
+	case AST_AND:
+	case AST_OR:
+		status = ast_exec(n->left);
+		if (flow != FLOW_NONE || shell_exit ||
+		    (status == 0) != (n->type == AST_AND))
+			return status;
+		return ast_exec(n->right);
+	case AST_NOT:
+		return last_status = !ast_exec(n->left);
+	case AST_IF:
+		status = ast_exec(n->left);
+		if (flow != FLOW_NONE || shell_exit)
+			return status;
+		if (status == 0)
+			return ast_exec(n->right);
+		if (n->alt)
+			return ast_exec(n->alt);
+		return last_status = 0;
+	case AST_WHILE:
+	case AST_UNTIL:
+		return exec_loop(n);
+	case AST_FOR:
+		return exec_for(n);
+	case AST_GROUP:
+		return ast_exec(n->left);
+	case AST_SUBSHELL:
+		return exec_subshell(n);
+	case AST_FUNC:
+		func_define(n->name, n->left, n->src);
+		return last_status = 0;
+	}
+	return last_status;
+}
@@ -6,7 +6,12 @@
 #include <sys/types.h>
 #include <dirent.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 #include "../include/builtin.h"
+#include "../include/history.h"
+#include "../include/shell.h"
+#include "../include/ast.h"
+#include "../include/coproc.h"
 
 /**
  * @brief 
@@ -92,32 +97,321 @@ int echo(char **args)
 	return 0;
 }
 
+/**
+ * @brief "exit [n]", run_cmd() stops the shell
+ * 
+ * @param args 
+ * @return int 
+ * Return n, or the status of the last command
+ */
 int exit_shell(char **args)
 {
-	return 0;
+	return args[1] ? atoi(args[1]) : last_status;
+}
+
+static void print_record(int num, int slot)
+{
+	printf("%2d: %s\n", num, history[slot]);
+	if (history_usage[slot].stages > 0)
+		usage_print(stdout, "   ", &history_usage[slot]);
+}
+
+static void print_match(size_t num, const char *line, size_t len)
+{
+	printf("%6zu: %.*s\n", num, (int)len, line);
 }
 
+/**
+ * @brief Show the last MAX_RECORD_NUM commands of this session
+ * "record --grep pattern" and "record --prefix pattern" search the whole
+ * persistent history instead
+ * @param args 
+ * @return int 
+ */
 int record(char **args)
 {
+	if (args[1] && (strcmp(args[1], "--grep") == 0 ||
+			strcmp(args[1], "--prefix") == 0)) {
+		if (args[2] == NULL) {
+			fprintf(stderr, "record: usage: record [--grep|--prefix] "
+					"pattern\n");
+			return -1;
+		}
+		bool prefix = strcmp(args[1], "--prefix") == 0;
+		if (history_search(args[2], prefix, print_match) < 0) {
+			fprintf(stderr, "record: no history file\n");
+			return -1;
+		}
+		return 0;
+	}
+
 	if (history_count < MAX_RECORD_NUM) {
 		for (int i = 0; i < history_count; ++i)
-			printf("%2d: %s\n", i + 1, history[i]);
+			print_record(i + 1, i);
 	} else {
 		for (int i = history_count % MAX_RECORD_NUM;
 		     i < history_count % MAX_RECORD_NUM + MAX_RECORD_NUM; ++i)
-			printf("%2d: %s\n",
-			       i - history_count % MAX_RECORD_NUM + 1,
-			       history[i % MAX_RECORD_NUM]);
+			print_record(i - history_count % MAX_RECORD_NUM + 1,
+				     i % MAX_RECORD_NUM);
+	}
+	return 0;
+}
+
+/**
+ * @brief "time" is handled as a prefix by shell(), reaching this
+ * function means it was used in the middle of a pipeline
+ * 
+ * @param args 
+ * @return int 
+ */
+int time_cmd(char **args)
+{
+	fprintf(stderr, "time: only valid at the start of a command\n");
+	return -1;
+}
+
+/**
+ * @brief Turn always-on accounting on or off
+ * When on, every command keeps its usage and "record" shows it
+ * @param args "timing [on|off]"
+ * @return int 
+ */
+int timing(char **args)
+{
+	if (args[1] == NULL) {
+		printf("timing: %s\n", usage_always ? "on" : "off");
+	} else if (strcmp(args[1], "on") == 0) {
+		usage_always = true;
+	} else if (strcmp(args[1], "off") == 0) {
+		usage_always = false;
+	} else {
+		fprintf(stderr, "timing: usage: timing [on|off]\n");
+		return -1;
 	}
 	return 0;
 }
 
+int true_cmd(char **args)
+{
+	return 0;
+}
+
+int false_cmd(char **args)
+{
+	return 1;
+}
+
+static bool to_long(const char *s, long *val)
+{
+	char *end;
+	*val = strtol(s, &end, 10);
+	if (*s == '\0' || *end != '\0') {
+		fprintf(stderr, "test: %s: integer expression expected\n", s);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Evaluate the argc words of a "test" expression
+ * 
+ * @return int 
+ * Return 0 for true, 1 for false, 2 on an error
+ */
+static int test_eval(char **a, int argc)
+{
+	struct stat st;
+	long l, r;
+
+	if (argc == 0)
+		return 1;
+	if (argc > 1 && strcmp(a[0], "!") == 0) {
+		int ret = test_eval(a + 1, argc - 1);
+		return ret == 2 ? 2 : !ret;
+	}
+	if (argc == 1)
+		return a[0][0] == '\0';
+	if (argc == 2) {
+		if (strcmp(a[0], "-n") == 0)
+			return a[1][0] == '\0';
+		if (strcmp(a[0], "-z") == 0)
+			return a[1][0] != '\0';
+		if (strcmp(a[0], "-e") == 0)
+			return stat(a[1], &st) != 0;
+		if (strcmp(a[0], "-f") == 0)
+			return stat(a[1], &st) != 0 || !S_ISREG(st.st_mode);
+		if (strcmp(a[0], "-d") == 0)
+			return stat(a[1], &st) != 0 || !S_ISDIR(st.st_mode);
+		if (strcmp(a[0], "-s") == 0)
+			return stat(a[1], &st) != 0 || st.st_size == 0;
+		if (strcmp(a[0], "-r") == 0)
+			return access(a[1], R_OK) != 0;
+		if (strcmp(a[0], "-w") == 0)
+			return access(a[1], W_OK) != 0;
+		if (strcmp(a[0], "-x") == 0)
+			return access(a[1], X_OK) != 0;
+	} else if (argc == 3) {
+		const char *op = a[1];
+		if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+			return strcmp(a[0], a[2]) != 0;
+		if (strcmp(op, "!=") == 0)
+			return strcmp(a[0], a[2]) == 0;
+		static const char *int_ops[] = { "-eq", "-ne", "-lt",
+						 "-le", "-gt", "-ge" };
+		for (int i = 0; i < 6; ++i) {
+			if (strcmp(op, int_ops[i]) != 0)
+				continue;
+			if (!to_long(a[0], &l) || !to_long(a[2], &r))
+				return 2;
+			bool res[] = { l == r, l != r, l < r,
+				       l <= r, l > r, l >= r };
+			return !res[i];
+		}
+	}
+	fprintf(stderr, "test: unknown expression\n");
+	return 2;
+}
+
+/**
+ * @brief "test expr" and "[ expr ]", so loop conditions don't fork
+ * 
+ * @param args 
+ * @return int 
+ */
+int test(char **args)
+{
+	int argc = 0;
+	while (args[argc])
+		++argc;
+	if (strcmp(args[0], "[") == 0) {
+		if (strcmp(args[argc - 1], "]") != 0) {
+			fprintf(stderr, "[: missing `]'\n");
+			return 2;
+		}
+		--argc;
+	}
+	return test_eval(args + 1, argc - 1);
+}
+
+/**
+ * @brief Ask the enclosing loops to stop, or to start the next iteration
+ * 
+ * @param args "break [n]" or "continue [n]"
+ * @return int 
+ */
+static int loop_ctl(char **args, enum flow type)
+{
+	int n = args[1] ? atoi(args[1]) : 1;
+	if (loop_depth == 0) {
+		fprintf(stderr, "%s: only meaningful in a loop\n", args[0]);
+		return 0;
+	}
+	if (n < 1) {
+		fprintf(stderr, "%s: %s: loop count out of range\n", args[0],
+			args[1]);
+		return 1;
+	}
+	flow = type;
+	flow_count = n < loop_depth ? n : loop_depth;
+	return 0;
+}
+
+int break_cmd(char **args)
+{
+	return loop_ctl(args, FLOW_BREAK);
+}
+
+int continue_cmd(char **args)
+{
+	return loop_ctl(args, FLOW_CONTINUE);
+}
+
+/**
+ * @brief "return [n]" from the running function
+ * 
+ * @param args 
+ * @return int 
+ */
+int return_cmd(char **args)
+{
+	if (func_depth == 0) {
+		fprintf(stderr, "return: can only `return' from a function\n");
+		return 1;
+	}
+	flow = FLOW_RETURN;
+	return args[1] ? atoi(args[1]) : last_status;
+}
+
+static void coproc_usage()
+{
+	fprintf(stderr, "coproc: usage: coproc start name cmd [args...]\n"
+			"               coproc send name [words...]\n"
+			"               coproc recv [-t ms] name\n"
+			"               coproc call [-t ms] name [words...]\n"
+			"               coproc close name\n");
+}
+
+/**
+ * @brief Long-lived worker fed one line per request
+ * "call" sends a line and prints the response line, "-t ms" bounds the
+ * wait (-1 waits forever). Without arguments the coprocesses are listed
+ * @param args 
+ * @return int 
+ */
+int coproc(char **args)
+{
+	int timeout = COPROC_TIMEOUT_MS, i = 2, ret;
+
+	if (args[1] == NULL) {
+		coproc_list();
+		return 0;
+	}
+	if (args[2] && strcmp(args[2], "-t") == 0) {
+		if (args[3] == NULL) {
+			coproc_usage();
+			return -1;
+		}
+		timeout = atoi(args[3]);
+		i = 4;
+	}
+	const char *name = args[i];
+	if (name == NULL) {
+		coproc_usage();
+		return -1;
+	}
+
+	if (strcmp(args[1], "start") == 0) {
+		if (args[i + 1] == NULL) {
+			coproc_usage();
+			return -1;
+		}
+		return coproc_start(name, args + i + 1);
+	}
+	if (strcmp(args[1], "send") == 0)
+		return coproc_send(name, args + i + 1);
+	if (strcmp(args[1], "recv") == 0)
+		return coproc_recv(name, timeout);
+	if (strcmp(args[1], "call") == 0) {
+		if ((ret = coproc_send(name, args + i + 1)) != 0)
+			return ret;
+		return coproc_recv(name, timeout);
+	}
+	if (strcmp(args[1], "close") == 0)
+		return coproc_close(name);
+	coproc_usage();
+	return -1;
+}
+
 const char *builtin_str[] = {
-	"help", "cd", "pwd", "echo", "exit", "record",
+	"help", "cd", "pwd", "echo", "exit", "record", "time", "timing",
+	"true", "false", "test", "[", "break", "continue", "return",
+	"coproc",
 };
 
 const int (*builtin_func[])(char **) = {
-	&help, &cd, &pwd, &echo, &exit_shell, &record,
+	&help, &cd, &pwd, &echo, &exit_shell, &record, &time_cmd, &timing,
+	&true_cmd, &false_cmd, &test, &test, &break_cmd, &continue_cmd,
+	&return_cmd, &coproc,
 };
 
 int num_builtins()
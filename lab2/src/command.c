@@ -3,12 +3,16 @@
 #include <stdbool.h>
 #include <string.h>
 #include "../include/command.h"
+#include "../include/history.h"
+#include "../include/lexer.h"
+#include "../include/expand.h"
+#include "../include/ast.h"
 
 /**
  * @brief Read the user's input string
  * 
  * @return char* 
- * Return string
+ * Return string, NULL for a blank line or at the end of the input
  */
 char *read_line()
 {
@@ -18,77 +22,256 @@ char *read_line()
         exit(1);
     }
 
-	if (fgets(buffer, BUF_SIZE, stdin) != NULL) {
-		if (buffer[0] == '\n' || buffer[0] == ' ' || buffer[0] == '\t') {
-			free(buffer);
-			buffer = NULL;
-		} 
-		else {
-			buffer[strcspn(buffer, "\n")] = 0;
-			strncpy(history[history_count % MAX_RECORD_NUM], buffer, BUF_SIZE);
-			++history_count;
-		}
+	if (fgets(buffer, BUF_SIZE, stdin) == NULL) {
+		free(buffer);
+		return NULL;
+	}
+	buffer[strcspn(buffer, "\n")] = 0;
+	if (buffer[strspn(buffer, " \t")] == '\0') {
+		free(buffer);
+		return NULL;
 	}
+	strncpy(history[history_count % MAX_RECORD_NUM], buffer, BUF_SIZE);
+	// run_cmd() adds the usage of every command of the line to it
+	memset(&history_usage[history_count % MAX_RECORD_NUM], 0,
+	       sizeof(struct proc_usage));
+	++history_count;
+	history_append(buffer);
 
 	return buffer;
 }
 
 /**
- * @brief Parse the user's command
+ * @brief Allocate a command with one empty cmd_node
  * 
- * @param line User input command
  * @return struct cmd* 
- * Return the parsed cmd structure
+ */
+struct cmd *new_cmd()
+{
+	struct cmd *cmd = (struct cmd *)malloc(sizeof(struct cmd));
+	cmd->head = new_cmd_node();
+	cmd->pipe_num = 0;
+	cmd->pipe_size = 0;
+	cmd->timed = false;
+	return cmd;
+}
+
+/**
+ * @brief Allocate an empty cmd_node with default stdin and stdout
+ * 
+ * @return struct cmd_node* 
+ */
+struct cmd_node *new_cmd_node()
+{
+	struct cmd_node *node = (struct cmd_node *)calloc(1, sizeof(struct cmd_node));
+	node->words_size = 10;
+	node->words = (char **)calloc(node->words_size, sizeof(char *));
+	node->in = 0;
+	node->out = 1;
+	node->pid = -1;
+	return node;
+}
+
+void push_word(struct cmd_node *node, char *word)
+{
+	if (node->words_num + 1 >= node->words_size) {
+		node->words_size *= 2;
+		node->words = (char **)realloc(node->words,
+					       node->words_size * sizeof(char *));
+	}
+	node->words[node->words_num++] = word;
+	node->words[node->words_num] = NULL;
+}
+
+bool is_redirect(enum token_type type)
+{
+	return type >= TOK_IN && type <= TOK_HERE_DOC;
+}
+
+/**
+ * @brief Store the redirection operator just read and its target word
+ * 
+ * @param ts Token stream, positioned after the operator
+ * @param type Operator
+ * @param node Command the redirection belongs to
+ * @return int 
+ * Return 0, -1 if the target is missing (the bad token stays peeked)
+ */
+int parse_redirect(struct token_stream *ts, enum token_type type,
+		   struct cmd_node *node)
+{
+	char *file;
+
+	if (type == TOK_ERR_TO_OUT) {
+		node->err_to_out = true;
+		return 0;
+	}
+	if (ts_peek(ts, &file) != TOK_WORD)
+		return -1;
+	ts_next(ts, NULL);
+	switch (type) {
+	case TOK_IN:
+		node->in_word = file;
+		break;
+	case TOK_OUT:
+	case TOK_APPEND:
+		node->out_word = file;
+		node->append = type == TOK_APPEND;
+		break;
+	case TOK_ERR:
+	case TOK_ERR_APPEND:
+		node->err_word = file;
+		node->err_append = type == TOK_ERR_APPEND;
+		break;
+	case TOK_HERE_DOC:
+		node->here_end = lex_unquote(file);
+		break;
+	case TOK_HERE_STR:
+		node->here_word = file;
+		break;
+	default:
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Report the token a parser stopped at
+ * 
+ * @param ts Token stream, the bad token is the next one
+ */
+void syntax_error(struct token_stream *ts)
+{
+	char *word;
+	enum token_type type = ts_peek(ts, &word);
+
+	if (type == TOK_ERROR)
+		fprintf(stderr, "syntax error: %s\n", ts->lx.err);
+	else if (type == TOK_END)
+		fprintf(stderr, "syntax error: unexpected end of input\n");
+	else
+		fprintf(stderr, "syntax error near unexpected token `%s'\n",
+			type == TOK_WORD ? lex_unquote(word) :
+					   token_name(type));
+}
+
+/**
+ * @brief Parse the user's command
+ * Tokens come from the in-place lexer, so quotes, escapes, tabs and
+ * operators without surrounding spaces ("a|b", ">out") are handled.
+ * The words stay raw until expand_cmd(), args is empty before that.
+ * Only a single pipeline is accepted, lists and compound commands go
+ * through ast_parse()
+ * @param line User input command, rewritten in place
+ * @return struct cmd* 
+ * Return the parsed cmd structure, NULL on a syntax error
  */
 struct cmd *split_line(char *line)
 {
-	int args_length = 10;
-    struct cmd *new_cmd = (struct cmd *)malloc(sizeof(struct cmd));
-    new_cmd->head = (struct cmd_node *)malloc(sizeof(struct cmd_node));
-    new_cmd->head->args = (char **)malloc(args_length * sizeof(char *));
-	for (int i = 0; i < args_length; ++i)
-		new_cmd->head->args[i] = NULL;
-    new_cmd->head->length = 0;
-    new_cmd->head->next = NULL;
-	new_cmd->pipe_num = 0;
-
-	struct cmd_node *temp = new_cmd->head;
-	temp->in_file 	= NULL;
-	temp->out_file 	= NULL;
-	temp->in       	= 0;
-	temp->out 		= 1;
-    char *token = strtok(line, " ");
-    while (token != NULL) {
-        if (token[0] == '|') {
-            struct cmd_node *new_pipe = (struct cmd_node *)malloc(sizeof(struct cmd_node));
-			new_pipe->args = (char **)malloc(args_length * sizeof(char *));
-			for (int i = 0; i < args_length; ++i)
-				new_pipe->args[i] = NULL;
-			new_pipe->length = 0;
-			new_pipe->next = NULL;
-			new_pipe->in_file  = NULL;
-    		new_pipe->out_file = NULL;
-		    new_pipe->in = 0;  
-    		new_pipe->out = 1; 
-			temp->next = new_pipe;
-			temp = new_pipe;
-        } else if (token[0] == '<') {
-			token = strtok(NULL, " ");
-            temp->in_file = token;
-        } else if (token[0] == '>') {
-			token = strtok(NULL, " ");
-            temp->out_file = token;
-        } else {
-			temp->args[temp->length] = token;
-			temp->length++;
-        }
-        token = strtok(NULL, " ");
-		new_cmd->pipe_num++;
+	struct cmd *cmd = new_cmd();
+	struct cmd_node *temp = cmd->head;
+	struct token_stream ts;
+	enum token_type type;
+	char *token = NULL;
 
-    }
+	ts_init(&ts, line);
+	while ((type = ts_peek(&ts, &token)) != TOK_END) {
+		if (type == TOK_WORD) {
+			ts_next(&ts, NULL);
+			if (temp == cmd->head && temp->words_num == 0 &&
+			    !cmd->timed && strcmp(token, "time") == 0)
+				cmd->timed = true;
+			else
+				push_word(temp, token);
+			continue;
+		}
+		if (type == TOK_PIPE) {
+			if (temp->words_num == 0)
+				goto error;
+			ts_next(&ts, NULL);
+			temp->next = new_cmd_node();
+			temp = temp->next;
+			cmd->pipe_num++;
+			continue;
+		}
+		if (!is_redirect(type))
+			goto error;
+		ts_next(&ts, NULL);
+		if (parse_redirect(&ts, type, temp) < 0)
+			goto error;
+	}
+	if (temp->words_num == 0 && temp != cmd->head)
+		goto error;
+	return cmd;
+
+error:
+	syntax_error(&ts);
+	free_cmd(cmd);
+	return NULL;
+}
 
-    return new_cmd;
+/**
+ * @brief Free the cmd structure, the words point into the line
+ * 
+ * @param cmd Command structure
+ */
+void free_cmd(struct cmd *cmd)
+{
+	while (cmd->head) {
+		struct cmd_node *temp = cmd->head;
+		cmd->head = cmd->head->next;
+		expand_free(temp);
+		ast_free(temp->body);
+		free(temp->words);
+		free(temp->here_doc);
+		free(temp);
+	}
+	free(cmd);
 }
+
+/**
+ * @brief Read the body of every "<< delimiter" in the command
+ * The lines following the command up to the delimiter line are kept
+ * in here_doc
+ * @param cmd Command structure
+ * @return int 
+ * Return 0, or -1 if the input ended before a delimiter
+ */
+int read_here_docs(struct cmd *cmd)
+{
+	char line[BUF_SIZE];
+	for (struct cmd_node *p = cmd->head; p; p = p->next) {
+		if (p->here_end == NULL)
+			continue;
+		size_t len = 0, cap = BUF_SIZE;
+		char *body = (char *)malloc(cap);
+		body[0] = '\0';
+		while (true) {
+			if (fgets(line, BUF_SIZE, stdin) == NULL) {
+				fprintf(stderr, "here-document delimited by "
+						"end-of-file (wanted `%s')\n",
+					p->here_end);
+				free(body);
+				return -1;
+			}
+			size_t n = strcspn(line, "\n");
+			if (n == strlen(p->here_end) &&
+			    strncmp(line, p->here_end, n) == 0)
+				break;
+			n = strlen(line);
+			if (len + n + 1 > cap) {
+				cap = 2 * (len + n + 1);
+				body = (char *)realloc(body, cap);
+			}
+			memcpy(body + len, line, n + 1);
+			len += n;
+		}
+		free(p->here_doc);
+		p->here_doc = body;
+	}
+	return 0;
+}
+
 /**
  * @brief Information used to test the cmd structure
  * 
@@ -124,6 +307,8 @@ void test_pipe_struct(struct cmd_node *temp){
 	}
 	printf(" in-file: %s\n", temp->in_file ? temp->in_file : "none");
 	printf("out-file: %s\n", temp->out_file ? temp->out_file : "none");
+	printf("err-file: %s\n", temp->err_file ? temp->err_file : "none");
+	printf("here-doc: %s\n", temp->here_doc ? temp->here_doc : "none");
 	printf(" in: %d\n", temp->in );
 	printf("out: %d\n", temp->out);
 	printf("============ CMD_NODE END ============\n");
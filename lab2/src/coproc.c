@@ -0,0 +1,272 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include "../include/coproc.h"
+
+/*
+ * Coprocesses
+ *
+ * A coprocess is a long-lived child whose stdin and stdout are pipes
+ * held by the shell, so a filter called thousands of times is forked
+ * and exec'd once. Requests and responses are single lines. The shell's
+ * ends are O_CLOEXEC: commands started later never inherit them, and
+ * the coprocess sees EOF as soon as the shell closes its stdin.
+ *
+ * The worker has to flush every response line (e.g. "sed -u",
+ * "stdbuf -oL cmd"), a fully buffered one makes "recv" time out.
+ */
+
+struct coproc {
+	char *name;
+	char *cmd;
+	pid_t pid;
+	int in; // child's stdin
+	int out; // child's stdout
+	char *buf; // read but not yet returned
+	size_t start, len;
+	struct coproc *next;
+};
+
+static struct coproc *coprocs = NULL;
+
+static struct coproc *find(const char *name)
+{
+	for (struct coproc *c = coprocs; c; c = c->next)
+		if (strcmp(c->name, name) == 0)
+			return c;
+	fprintf(stderr, "coproc: %s: no such coprocess\n", name);
+	return NULL;
+}
+
+/**
+ * @brief Start argv as coprocess name
+ * 
+ * @param name Handle used by the other commands
+ * @param argv Command and arguments
+ * @return int 
+ * Return 0, -1 on failure
+ */
+int coproc_start(const char *name, char **argv)
+{
+	int in[2], out[2];
+
+	for (struct coproc *c = coprocs; c; c = c->next) {
+		if (strcmp(c->name, name) == 0) {
+			fprintf(stderr, "coproc: %s: already running\n", name);
+			return -1;
+		}
+	}
+	if (pipe2(in, O_CLOEXEC) < 0) {
+		perror("coproc: pipe2");
+		return -1;
+	}
+	if (pipe2(out, O_CLOEXEC) < 0) {
+		perror("coproc: pipe2");
+		close(in[0]);
+		close(in[1]);
+		return -1;
+	}
+
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("coproc: fork");
+		close(in[0]);
+		close(in[1]);
+		close(out[0]);
+		close(out[1]);
+		return -1;
+	} else if (pid == 0) {
+		// dup2() clears O_CLOEXEC on the copies
+		dup2(in[0], STDIN_FILENO);
+		dup2(out[1], STDOUT_FILENO);
+		execvp(argv[0], argv);
+		perror(argv[0]);
+		_exit(127);
+	}
+	close(in[0]);
+	close(out[1]);
+
+	struct coproc *c = (struct coproc *)calloc(1, sizeof(struct coproc));
+	c->name = strdup(name);
+	c->cmd = strdup(argv[0]);
+	c->pid = pid;
+	c->in = in[1];
+	c->out = out[0];
+	c->buf = (char *)malloc(COPROC_BUF);
+	c->next = coprocs;
+	coprocs = c;
+	return 0;
+}
+
+/**
+ * @brief Write the words, space separated, as one request line
+ * SIGPIPE is ignored for the write, a dead coprocess is an error of the
+ * command and not of the shell
+ * @return int 
+ * Return 0, -1 on failure
+ */
+int coproc_send(const char *name, char **words)
+{
+	struct coproc *c = find(name);
+	struct sigaction ign = { .sa_handler = SIG_IGN }, old;
+	size_t len = 0, cap = 256;
+	int ret = 0;
+
+	if (c == NULL)
+		return -1;
+	char *line = (char *)malloc(cap);
+	for (int i = 0; words[i]; ++i) {
+		size_t n = strlen(words[i]);
+		if (len + n + 2 > cap)
+			line = (char *)realloc(line, cap = 2 * (len + n + 2));
+		memcpy(line + len, words[i], n);
+		len += n;
+		line[len++] = words[i + 1] ? ' ' : '\n';
+	}
+	if (len == 0)
+		line[len++] = '\n';
+
+	sigaction(SIGPIPE, &ign, &old);
+	for (size_t done = 0; done < len;) {
+		ssize_t n = write(c->in, line + done, len - done);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "coproc: %s: %s\n", name, strerror(errno));
+			ret = -1;
+			break;
+		}
+		done += n;
+	}
+	sigaction(SIGPIPE, &old, NULL);
+	free(line);
+	return ret;
+}
+
+static long elapsed_ms(const struct timespec *t0)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (t.tv_sec - t0->tv_sec) * 1000 +
+	       (t.tv_nsec - t0->tv_nsec) / 1000000;
+}
+
+/**
+ * @brief Print the next response line of the coprocess
+ * A line longer than COPROC_BUF is returned in pieces
+ * @param name Coprocess
+ * @param timeout_ms Longest wait for the line, < 0 waits forever
+ * @return int 
+ * Return 0, 1 at EOF, 124 on timeout, -1 on failure
+ */
+int coproc_recv(const char *name, int timeout_ms)
+{
+	struct coproc *c = find(name);
+	struct timespec t0;
+
+	if (c == NULL)
+		return -1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	while (true) {
+		char *nl = memchr(c->buf + c->start, '\n', c->len);
+		if (nl || c->len == COPROC_BUF) {
+			size_t n = nl ? (size_t)(nl - c->buf - c->start) : c->len;
+			printf("%.*s\n", (int)n, c->buf + c->start);
+			n += nl != NULL;
+			c->start += n;
+			c->len -= n;
+			return 0;
+		}
+		if (c->start > 0) {
+			memmove(c->buf, c->buf + c->start, c->len);
+			c->start = 0;
+		}
+
+		int wait = -1;
+		if (timeout_ms >= 0) {
+			long left = timeout_ms - elapsed_ms(&t0);
+			wait = left > 0 ? left : 0;
+		}
+		struct pollfd pfd = { .fd = c->out, .events = POLLIN };
+		int ready = poll(&pfd, 1, wait);
+		if (ready < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("coproc: poll");
+			return -1;
+		}
+		if (ready == 0) {
+			fprintf(stderr, "coproc: %s: timed out\n", name);
+			return 124;
+		}
+		ssize_t n = read(c->out, c->buf + c->len, COPROC_BUF - c->len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("coproc: read");
+			return -1;
+		}
+		if (n == 0) {
+			// a last line without a newline
+			if (c->len == 0)
+				return 1;
+			printf("%.*s\n", (int)c->len, c->buf);
+			c->len = 0;
+			return 0;
+		}
+		c->len += n;
+	}
+}
+
+/**
+ * @brief Close the coprocess stdin and wait for it to exit
+ * 
+ * @return int 
+ * Return its exit code, -1 if there is no such coprocess
+ */
+int coproc_close(const char *name)
+{
+	struct coproc **pp = &coprocs, *c;
+	int status;
+
+	while (*pp && strcmp((*pp)->name, name) != 0)
+		pp = &(*pp)->next;
+	if ((c = *pp) == NULL) {
+		fprintf(stderr, "coproc: %s: no such coprocess\n", name);
+		return -1;
+	}
+	*pp = c->next;
+	close(c->in);
+	close(c->out);
+	if (waitpid(c->pid, &status, 0) < 0)
+		status = 0;
+	free(c->name);
+	free(c->cmd);
+	free(c->buf);
+	free(c);
+	if (WIFSIGNALED(status))
+		return 128 + WTERMSIG(status);
+	return WEXITSTATUS(status);
+}
+
+void coproc_list()
+{
+	for (struct coproc *c = coprocs; c; c = c->next)
+		printf("%s\t%d\t%s\n", c->name, (int)c->pid, c->cmd);
+}
+
+void coproc_close_all()
+{
+	while (coprocs)
+		coproc_close(coprocs->name);
+}
@@ -0,0 +1,253 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include "../include/dircache.h"
+
+/*
+ * Directory scan cache for globbing
+ *
+ * A directory is read once and its sorted names are kept until its
+ * mtime (or inode) changes, so a loop globbing the same large directory
+ * only pays one stat() per glob. A scan is not trusted while the
+ * directory mtime is within DIRCACHE_RACY_SEC of the scan: a file
+ * created in the same timestamp tick would not change the mtime.
+ */
+
+#define DIRCACHE_RACY_SEC 2
+
+struct dir_entry {
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	time_t scanned;
+	unsigned long used; // LRU clock
+	struct dir_list list;
+	char *names; // storage of list.names
+};
+
+static struct dir_entry cache[DIRCACHE_MAX];
+static unsigned long clock_tick;
+
+static int cmp_name(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void entry_free(struct dir_entry *e)
+{
+	free(e->path);
+	free(e->list.names);
+	free(e->names);
+	memset(e, 0, sizeof(*e));
+}
+
+static int scan(struct dir_entry *e, const char *dir)
+{
+	DIR *d = opendir(dir);
+	if (d == NULL)
+		return -1;
+
+	size_t len = 0, cap = 4096, num = 0;
+	char *names = malloc(cap);
+	struct dirent *de;
+	while ((de = readdir(d)) != NULL) {
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+			continue;
+		size_t n = strlen(de->d_name) + 1;
+		if (len + n > cap) {
+			cap = 2 * (len + n);
+			names = realloc(names, cap);
+		}
+		memcpy(names + len, de->d_name, n);
+		len += n;
+		++num;
+	}
+	closedir(d);
+
+	e->names = names;
+	e->list.num = num;
+	e->list.names = malloc((num ? num : 1) * sizeof(char *));
+	for (size_t i = 0, off = 0; i < num; ++i) {
+		e->list.names[i] = names + off;
+		off += strlen(names + off) + 1;
+	}
+	qsort(e->list.names, num, sizeof(char *), cmp_name);
+	e->scanned = time(NULL);
+	return 0;
+}
+
+/**
+ * @brief Names of a directory, scanned again only if it changed
+ * 
+ * @param dir Directory path
+ * @return const struct dir_list* 
+ * Return NULL if the directory can't be read
+ */
+const struct dir_list *dircache_get(const char *dir)
+{
+	struct stat st;
+	struct dir_entry *e = NULL, *victim = &cache[0];
+
+	if (stat(dir, &st) < 0 || !S_ISDIR(st.st_mode))
+		return NULL;
+	for (int i = 0; i < DIRCACHE_MAX; ++i) {
+		if (cache[i].path && strcmp(cache[i].path, dir) == 0) {
+			e = &cache[i];
+			break;
+		}
+		if (cache[i].used < victim->used)
+			victim = &cache[i];
+	}
+
+	if (e && e->dev == st.st_dev && e->ino == st.st_ino &&
+	    e->mtime.tv_sec == st.st_mtim.tv_sec &&
+	    e->mtime.tv_nsec == st.st_mtim.tv_nsec &&
+	    e->scanned - st.st_mtim.tv_sec >= DIRCACHE_RACY_SEC) {
+		e->used = ++clock_tick;
+		return &e->list;
+	}
+
+	if (e == NULL)
+		e = victim;
+	entry_free(e);
+	if (scan(e, dir) < 0)
+		return NULL;
+	e->path = strdup(dir);
+	e->dev = st.st_dev;
+	e->ino = st.st_ino;
+	e->mtime = st.st_mtim;
+	e->used = ++clock_tick;
+	return &e->list;
+}
+
+void dircache_clear()
+{
+	for (int i = 0; i < DIRCACHE_MAX; ++i)
+		entry_free(&cache[i]);
+}
+
+static bool has_magic(const char *s, size_t len)
+{
+	for (size_t i = 0; i < len; ++i) {
+		if (s[i] == '\\' && i + 1 < len)
+			++i;
+		else if (s[i] == '*' || s[i] == '?' || s[i] == '[')
+			return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Literal prefix of a pattern component, with escapes removed
+ * 
+ * @param pat Pattern component
+ * @param buf Receives the prefix
+ * @return size_t 
+ * Return the prefix length
+ */
+static size_t literal_prefix(const char *pat, char *buf)
+{
+	size_t n = 0;
+	for (; *pat && *pat != '*' && *pat != '?' && *pat != '['; ++pat) {
+		if (*pat == '\\' && pat[1])
+			++pat;
+		buf[n++] = *pat;
+	}
+	buf[n] = '\0';
+	return n;
+}
+
+/**
+ * @brief Match the components of rest below dir
+ * 
+ * @param dir Directory matched so far, "" for the current directory
+ * @param rest Remaining pattern, without a leading '/'
+ * @return int 
+ * Return the number of matches
+ */
+static int glob_dir(const char *dir, const char *rest, glob_cb cb, void *arg)
+{
+	const char *slash = strchr(rest, '/');
+	size_t clen = slash ? (size_t)(slash - rest) : strlen(rest);
+	char *comp = strndup(rest, clen);
+	char path[4096];
+	int found = 0;
+
+	if (!has_magic(comp, clen)) {
+		// literal component: unescape and require it to exist
+		char lit[clen + 1];
+		literal_prefix(comp, lit);
+		snprintf(path, sizeof(path), "%s%s%s", dir, lit, slash ? "/" : "");
+		struct stat st;
+		if (slash && slash[1]) {
+			found = glob_dir(path, slash + 1, cb, arg);
+		} else if (lstat(path, &st) == 0) {
+			cb(path, arg);
+			found = 1;
+		}
+		free(comp);
+		return found;
+	}
+
+	const struct dir_list *list = dircache_get(*dir ? dir : ".");
+	if (list == NULL) {
+		free(comp);
+		return 0;
+	}
+
+	// names are sorted: jump to the ones sharing the literal prefix
+	char prefix[clen + 1];
+	size_t plen = literal_prefix(comp, prefix);
+	size_t lo = 0, hi = list->num;
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (strncmp(list->names[mid], prefix, plen) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (size_t i = lo; i < list->num; ++i) {
+		const char *name = list->names[i];
+		if (strncmp(name, prefix, plen) != 0)
+			break;
+		if (fnmatch(comp, name, FNM_PERIOD) != 0)
+			continue;
+		snprintf(path, sizeof(path), "%s%s%s", dir, name, slash ? "/" : "");
+		struct stat st;
+		if (slash && slash[1]) {
+			found += glob_dir(path, slash + 1, cb, arg);
+		} else if (slash == NULL || stat(path, &st) == 0) {
+			// a trailing '/' only matches directories
+			cb(path, arg);
+			++found;
+		}
+	}
+	free(comp);
+	return found;
+}
+
+/**
+ * @brief Expand a glob pattern, "\" escapes a literal character
+ * 
+ * @param pattern Pattern such as "*.log"
+ * @param cb Called with every matching path, in sorted order
+ * @param arg Passed to cb
+ * @return int 
+ * Return the number of matches
+ */
+int dircache_glob(const char *pattern, glob_cb cb, void *arg)
+{
+	if (pattern[0] == '/') {
+		while (pattern[1] == '/')
+			++pattern;
+		return glob_dir("/", pattern + 1, cb, arg);
+	}
+	return glob_dir("", pattern, cb, arg);
+}
@@ -0,0 +1,418 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include "../include/expand.h"
+#include "../include/lexer.h"
+#include "../include/dircache.h"
+#include "../include/shell.h"
+#include "../include/ast.h"
+#include "../include/arith.h"
+
+/*
+ * Expansion stage between split_line() and execution
+ *
+ * Each raw word from the lexer goes through tilde, "$NAME", "${NAME}",
+ * "$?", "$$", "$1", "$#", "$@", "$((expr))" and "$(command)" expansion, then unquoted results are split
+ * on blanks and globbed through the directory cache. Quote removal comes
+ * for free: the CTL_* markers are never copied to the result.
+ */
+
+enum expand_mode {
+	EXPAND_FIELDS, // argv word: field splitting and globbing
+	EXPAND_SINGLE, // redirection target, assignment: one string
+};
+
+// expanded characters, q[i] tells whether s[i] was quoted
+struct qbuf {
+	char *s, *q;
+	size_t len, cap;
+};
+
+// NUL separated results
+struct out {
+	char *s;
+	size_t len, cap;
+	size_t *off;
+	int num, num_cap;
+};
+
+static void qb_put(struct qbuf *b, const char *s, size_t n, bool quoted)
+{
+	if (b->len + n > b->cap) {
+		b->cap = 2 * (b->len + n) + 64;
+		b->s = (char *)realloc(b->s, b->cap);
+		b->q = (char *)realloc(b->q, b->cap);
+	}
+	memcpy(b->s + b->len, s, n);
+	memset(b->q + b->len, quoted, n);
+	b->len += n;
+}
+
+static void out_begin(struct out *o)
+{
+	if (o->num == o->num_cap) {
+		o->num_cap = o->num_cap ? 2 * o->num_cap : 16;
+		o->off = (size_t *)realloc(o->off, o->num_cap * sizeof(size_t));
+	}
+	o->off[o->num++] = o->len;
+}
+
+static void out_put(struct out *o, const char *s, size_t n)
+{
+	if (o->len + n + 1 > o->cap) {
+		o->cap = 2 * (o->len + n + 1) + 256;
+		o->s = (char *)realloc(o->s, o->cap);
+	}
+	memcpy(o->s + o->len, s, n);
+	o->len += n;
+}
+
+static void out_end(struct out *o)
+{
+	out_put(o, "", 0);
+	o->s[o->len++] = '\0';
+}
+
+static void out_add(struct out *o, const char *s, size_t n)
+{
+	out_begin(o);
+	out_put(o, s, n);
+	out_end(o);
+}
+
+static void glob_found(const char *path, void *arg)
+{
+	out_add((struct out *)arg, path, strlen(path));
+}
+
+static bool is_name_start(char c)
+{
+	return isalpha((unsigned char)c) || c == '_';
+}
+
+static bool is_name(char c)
+{
+	return isalnum((unsigned char)c) || c == '_';
+}
+
+/**
+ * @brief Whether a raw word is "NAME=value"
+ * 
+ * @param w Raw word
+ * @return bool 
+ */
+static bool is_assignment(const char *w)
+{
+	if (!is_name_start(*w))
+		return false;
+	while (is_name(*++w))
+		;
+	return *w == '=';
+}
+
+static int expand_word(const char *raw, enum expand_mode mode, struct out *o);
+
+/**
+ * @brief Expand "$..." at p into b
+ * 
+ * @param p Points at the '$'
+ * @param b Expanded characters
+ * @param quoted Inside double quotes
+ * @return const char* 
+ * Return the first byte after the expansion, NULL on a bad substitution
+ */
+static const char *expand_dollar(const char *p, struct qbuf *b, bool quoted)
+{
+	char num[32];
+	const char *val = NULL;
+
+	if (p[1] == '(') {
+		const char *end = lex_skip_subst((char *)p + 2);
+		if (end == NULL)
+			return NULL;
+		if (p[2] == '(' && end[-1] == ')') { // "$((expr))"
+			long val;
+			struct out e = { 0 };
+			char *expr = strndup(p + 3, end - p - 4);
+			// "$1", "$(cmd)" inside are expanded first
+			int ret = expand_word(expr, EXPAND_SINGLE, &e);
+			free(expr);
+			if (ret == 0)
+				ret = arith_eval(e.s, &val);
+			free(e.s);
+			free(e.off);
+			if (ret < 0)
+				return NULL;
+			snprintf(num, sizeof(num), "%ld", val);
+			qb_put(b, num, strlen(num), quoted);
+			return end + 1;
+		}
+		char *line = strndup(p + 2, end - p - 2);
+		char *res = command_subst(line);
+		free(line);
+		if (res) {
+			qb_put(b, res, strlen(res), quoted);
+			free(res);
+		}
+		return end + 1;
+	}
+	if (p[1] == '?' || p[1] == '$') {
+		snprintf(num, sizeof(num), "%d",
+			 p[1] == '?' ? last_status : (int)getpid());
+		qb_put(b, num, strlen(num), quoted);
+		return p + 2;
+	}
+	if (isdigit((unsigned char)p[1])) {
+		int i = p[1] - '0';
+		val = i == 0 ? "my_shell" : i <= pos_num ? pos_args[i] : "";
+		qb_put(b, val, strlen(val), quoted);
+		return p + 2;
+	}
+	if (p[1] == '#') {
+		snprintf(num, sizeof(num), "%d", pos_num);
+		qb_put(b, num, strlen(num), quoted);
+		return p + 2;
+	}
+	if (p[1] == '@' || p[1] == '*') {
+		// joined with spaces, unquoted it splits back into fields
+		for (int i = 1; i <= pos_num; ++i) {
+			if (i > 1)
+				qb_put(b, " ", 1, quoted);
+			qb_put(b, pos_args[i], strlen(pos_args[i]), quoted);
+		}
+		return p + 2;
+	}
+
+	const char *name = p + 1, *end;
+	bool braced = *name == '{';
+	if (braced)
+		++name;
+	if (!is_name_start(*name)) {
+		if (braced)
+			return NULL;
+		qb_put(b, "$", 1, quoted);
+		return p + 1;
+	}
+	for (end = name; is_name(*end); ++end)
+		;
+	if (braced && *end != '}')
+		return NULL;
+
+	char *var = strndup(name, end - name);
+	val = getenv(var);
+	free(var);
+	if (val)
+		qb_put(b, val, strlen(val), quoted);
+	return end + braced;
+}
+
+/**
+ * @brief Emit one field, globbing it if it has unquoted wildcards
+ * 
+ */
+static void emit_field(struct qbuf *b, size_t start, size_t end, bool magic,
+		       struct out *o)
+{
+	if (magic) {
+		// quoted wildcards are escaped so they match literally
+		char *pat = (char *)malloc(2 * (end - start) + 1), *w = pat;
+		for (size_t i = start; i < end; ++i) {
+			if (b->q[i] && strchr("*?[]\\", b->s[i]))
+				*w++ = '\\';
+			*w++ = b->s[i];
+		}
+		*w = '\0';
+		int found = dircache_glob(pat, glob_found, o);
+		free(pat);
+		if (found > 0)
+			return;
+	}
+	// no match keeps the word, like sh
+	out_add(o, b->s + start, end - start);
+}
+
+static bool is_ifs(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n';
+}
+
+/**
+ * @brief Expand one raw word
+ * 
+ * @param raw Word from the lexer, with CTL_* markers
+ * @param mode EXPAND_FIELDS or EXPAND_SINGLE
+ * @param o Results are appended here
+ * @return int 
+ * Return 0, -1 on a bad substitution
+ */
+static int expand_word(const char *raw, enum expand_mode mode, struct out *o)
+{
+	struct qbuf b = { 0 };
+	bool single = false, dquote = false, had_quotes = false;
+	const char *p = raw;
+
+	if (p[0] == '~' && (p[1] == '/' || p[1] == '\0')) {
+		const char *home = getenv("HOME");
+		qb_put(&b, home ? home : "~", strlen(home ? home : "~"), true);
+		++p;
+	}
+	while (*p) {
+		if (*p == CTL_QUOTE && !dquote) {
+			single = !single;
+			had_quotes = true;
+			++p;
+		} else if (*p == CTL_DQUOTE && !single) {
+			dquote = !dquote;
+			had_quotes = true;
+			++p;
+		} else if (*p == CTL_ESC && p[1] && !single) {
+			qb_put(&b, p + 1, 1, true);
+			p += 2;
+		} else if (*p == '$' && !single) {
+			p = expand_dollar(p, &b, dquote);
+			if (p == NULL) {
+				fprintf(stderr, "%s: bad substitution\n", raw);
+				free(b.s);
+				free(b.q);
+				return -1;
+			}
+		} else {
+			qb_put(&b, p, 1, single || dquote);
+			++p;
+		}
+	}
+
+	if (mode == EXPAND_SINGLE) {
+		out_add(o, b.s ? b.s : "", b.len);
+	} else {
+		int before = o->num;
+		size_t i = 0;
+		while (i < b.len) {
+			while (i < b.len && !b.q[i] && is_ifs(b.s[i]))
+				++i;
+			if (i == b.len)
+				break;
+			size_t start = i;
+			bool magic = false;
+			for (; i < b.len && (b.q[i] || !is_ifs(b.s[i])); ++i)
+				if (!b.q[i] && strchr("*?[", b.s[i]))
+					magic = true;
+			emit_field(&b, start, i, magic, o);
+		}
+		// "" is an empty argument, an empty $VAR is none
+		if (o->num == before && had_quotes)
+			out_add(o, "", 0);
+	}
+	free(b.s);
+	free(b.q);
+	return 0;
+}
+
+/**
+ * @brief Release the previous expansion of a node
+ * 
+ * @param node cmd_node structure
+ */
+void expand_free(struct cmd_node *node)
+{
+	free(node->vars);
+	free(node->expanded);
+	node->vars = node->args = NULL;
+	node->expanded = NULL;
+	node->vars_num = node->length = 0;
+	node->in_file = node->out_file = node->err_file = NULL;
+	node->here_str = NULL;
+}
+
+static int expand_node(struct cmd_node *p)
+{
+	struct out o = { 0 };
+	int vars = 0, file_idx[4];
+	char **files[4] = { &p->in_file, &p->out_file, &p->err_file,
+			    &p->here_str };
+	char *words[4] = { p->in_word, p->out_word, p->err_word, p->here_word };
+	bool command = false;
+
+	expand_free(p);
+	for (int i = 0; i < p->words_num; ++i) {
+		const char *w = p->words[i];
+		int ret;
+		if (!command && !p->word_list && is_assignment(w)) {
+			const char *eq = strchr(w, '=');
+			struct out val = { 0 };
+			ret = expand_word(eq + 1, EXPAND_SINGLE, &val);
+			if (ret == 0) {
+				out_begin(&o);
+				out_put(&o, w, eq + 1 - w);
+				out_put(&o, val.s, strlen(val.s));
+				out_end(&o);
+				++vars;
+			}
+			free(val.s);
+			free(val.off);
+		} else {
+			command = true;
+			ret = expand_word(w, EXPAND_FIELDS, &o);
+		}
+		if (ret < 0)
+			goto error;
+	}
+	int argc = o.num - vars;
+
+	for (int i = 0; i < 4; ++i) {
+		struct out val = { 0 };
+		file_idx[i] = -1;
+		if (words[i] == NULL)
+			continue;
+		if (expand_word(words[i], EXPAND_SINGLE, &val) < 0) {
+			free(val.s);
+			free(val.off);
+			goto error;
+		}
+		out_begin(&o);
+		out_put(&o, val.s, strlen(val.s));
+		if (i == 3) // a here-string ends with a newline
+			out_put(&o, "\n", 1);
+		out_end(&o);
+		file_idx[i] = o.num - 1;
+		free(val.s);
+		free(val.off);
+	}
+
+	p->vars = (char **)malloc((vars + argc + 1) * sizeof(char *));
+	for (int i = 0; i < vars + argc; ++i)
+		p->vars[i] = o.s + o.off[i];
+	p->vars[vars + argc] = NULL;
+	p->vars_num = vars;
+	p->args = p->vars + vars;
+	p->length = argc;
+	for (int i = 0; i < 4; ++i)
+		if (file_idx[i] >= 0)
+			*files[i] = o.s + o.off[file_idx[i]];
+	p->expanded = o.s;
+	free(o.off);
+	return 0;
+
+error:
+	free(o.s);
+	free(o.off);
+	return -1;
+}
+
+/**
+ * @brief Expand every node of the command, results replace args
+ * The raw words are kept, so the command can be expanded again
+ * @param cmd Command structure
+ * @return int 
+ * Return 0, -1 on an expansion error
+ */
+int expand_cmd(struct cmd *cmd)
+{
+	for (struct cmd_node *p = cmd->head; p; p = p->next)
+		if (expand_node(p) < 0)
+			return -1;
+	return 0;
+}
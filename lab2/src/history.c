@@ -0,0 +1,304 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/history.h"
+
+/*
+ * Persistent history
+ *
+ * Every line is appended to the history file with one O_APPEND write.
+ * Nothing is read at startup: the file is mmap'd and indexed the first
+ * time it is searched, and later searches only index the bytes appended
+ * since then (by this shell or by any other one sharing the file).
+ *
+ * The index maps every trigram (3 consecutive bytes) to the sorted list
+ * of entries containing it. A pattern of length >= 3 only has to be
+ * verified against the entries of its rarest trigram.
+ */
+
+struct posting {
+	uint32_t key; // trigram + 1, 0 marks an empty slot
+	uint32_t n, cap;
+	uint32_t *ids;
+};
+
+static int hist_fd = -1;
+
+static char *map;
+static size_t map_len; // bytes mapped
+static size_t indexed; // bytes indexed, always at a line boundary
+
+static size_t *entry_off;
+static uint32_t *entry_len;
+static size_t entry_num, entry_cap;
+
+static struct posting *table;
+static size_t table_cap, table_used;
+
+static uint32_t trigram(const char *s)
+{
+	return ((uint32_t)(unsigned char)s[0] << 16 |
+		(uint32_t)(unsigned char)s[1] << 8 | (unsigned char)s[2]) + 1;
+}
+
+static size_t slot_of(uint32_t key, size_t cap)
+{
+	return (key * 2654435761u) & (cap - 1);
+}
+
+static struct posting *table_find(uint32_t key)
+{
+	if (table_cap == 0)
+		return NULL;
+	for (size_t i = slot_of(key, table_cap);; i = (i + 1) & (table_cap - 1)) {
+		if (table[i].key == key)
+			return &table[i];
+		if (table[i].key == 0)
+			return NULL;
+	}
+}
+
+static void table_grow()
+{
+	size_t cap = table_cap ? table_cap * 2 : 4096;
+	struct posting *t = calloc(cap, sizeof(*t));
+	if (t == NULL) {
+		perror("history");
+		exit(1);
+	}
+	for (size_t i = 0; i < table_cap; ++i) {
+		if (table[i].key == 0)
+			continue;
+		size_t j = slot_of(table[i].key, cap);
+		while (t[j].key)
+			j = (j + 1) & (cap - 1);
+		t[j] = table[i];
+	}
+	free(table);
+	table = t;
+	table_cap = cap;
+}
+
+static void table_add(uint32_t key, uint32_t id)
+{
+	if ((table_used + 1) * 2 > table_cap)
+		table_grow();
+	size_t i = slot_of(key, table_cap);
+	while (table[i].key && table[i].key != key)
+		i = (i + 1) & (table_cap - 1);
+
+	struct posting *p = &table[i];
+	if (p->key == 0) {
+		p->key = key;
+		++table_used;
+	}
+	// the same trigram may repeat inside one entry
+	if (p->n && p->ids[p->n - 1] == id)
+		return;
+	if (p->n == p->cap) {
+		p->cap = p->cap ? p->cap * 2 : 4;
+		p->ids = realloc(p->ids, p->cap * sizeof(uint32_t));
+		if (p->ids == NULL) {
+			perror("history");
+			exit(1);
+		}
+	}
+	p->ids[p->n++] = id;
+}
+
+static void index_entry(size_t off, size_t len)
+{
+	if (entry_num == entry_cap) {
+		entry_cap = entry_cap ? entry_cap * 2 : 1024;
+		entry_off = realloc(entry_off, entry_cap * sizeof(size_t));
+		entry_len = realloc(entry_len, entry_cap * sizeof(uint32_t));
+		if (entry_off == NULL || entry_len == NULL) {
+			perror("history");
+			exit(1);
+		}
+	}
+	uint32_t id = entry_num++;
+	entry_off[id] = off;
+	entry_len[id] = len;
+	for (size_t i = 0; i + 3 <= len; ++i)
+		table_add(trigram(&map[off + i]), id);
+}
+
+/**
+ * @brief Drop the mapping and the whole index, the file stays open
+ * 
+ */
+static void history_drop_index()
+{
+	for (size_t i = 0; i < table_cap; ++i)
+		free(table[i].ids);
+	free(table);
+	free(entry_off);
+	free(entry_len);
+	if (map)
+		munmap(map, map_len);
+	table = NULL;
+	entry_off = NULL;
+	entry_len = NULL;
+	map = NULL;
+	table_cap = table_used = entry_num = entry_cap = 0;
+	map_len = indexed = 0;
+}
+
+/**
+ * @brief Map and index whatever was appended since the last call
+ * 
+ * @return int 
+ * Return 0 on success, -1 if the history file is unusable
+ */
+static int history_refresh()
+{
+	struct stat st;
+	if (hist_fd < 0 || fstat(hist_fd, &st) < 0)
+		return -1;
+	size_t size = st.st_size;
+	// truncated or rotated by another shell: the index points past EOF
+	if (size < indexed)
+		history_drop_index();
+	if (size == indexed)
+		return 0;
+
+	char *m = map;
+	if (map == NULL) {
+		m = mmap(NULL, size, PROT_READ, MAP_SHARED, hist_fd, 0);
+	} else if (size > map_len) {
+		m = mremap(map, map_len, size, MREMAP_MAYMOVE);
+	}
+	if (m == MAP_FAILED) {
+		perror("history: mmap");
+		// the postings would point into a mapping that is gone
+		history_drop_index();
+		return -1;
+	}
+	map = m;
+	if (size > map_len)
+		map_len = size;
+
+	// a partial last line is left for the next refresh
+	const char *end;
+	while (indexed < size &&
+	       (end = memchr(&map[indexed], '\n', size - indexed)) != NULL) {
+		size_t len = end - &map[indexed];
+		if (len > 0)
+			index_entry(indexed, len);
+		indexed += len + 1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Open the history file for appending, it is not read here
+ * 
+ */
+void history_init()
+{
+	char path[4096];
+	const char *file = getenv(HISTFILE_ENV);
+	const char *home = getenv("HOME");
+
+	if (file == NULL && home == NULL)
+		return;
+	if (file == NULL) {
+		snprintf(path, sizeof(path), "%s/%s", home, HISTFILE_NAME);
+		file = path;
+	}
+	hist_fd = open(file, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+	if (hist_fd < 0)
+		perror(file);
+}
+
+/**
+ * @brief Append one line to the history file
+ * 
+ * @param line Command line without the trailing newline
+ */
+void history_append(const char *line)
+{
+	if (hist_fd < 0)
+		return;
+	size_t len = strlen(line);
+	char *buf = malloc(len + 1);
+	if (buf == NULL)
+		return;
+	memcpy(buf, line, len);
+	buf[len] = '\n';
+	// one write so concurrent shells don't interleave inside a line
+	if (write(hist_fd, buf, len + 1) < 0)
+		perror("history");
+	free(buf);
+}
+
+static int match(uint32_t id, const char *pattern, size_t m, bool prefix)
+{
+	const char *s = &map[entry_off[id]];
+	if (entry_len[id] < m)
+		return 0;
+	if (prefix)
+		return memcmp(s, pattern, m) == 0;
+	return memmem(s, entry_len[id], pattern, m) != NULL;
+}
+
+/**
+ * @brief Search the whole persistent history
+ * 
+ * @param pattern Substring to look for
+ * @param prefix Only match entries starting with pattern
+ * @param cb Called with the 1-based entry number of every match, in order
+ * @return long 
+ * Return the number of matches, -1 if there is no history file
+ */
+long history_search(const char *pattern, bool prefix, history_cb cb)
+{
+	size_t m = strlen(pattern);
+	long found = 0;
+
+	if (history_refresh() < 0)
+		return -1;
+
+	if (m < 3) {
+		for (uint32_t id = 0; id < entry_num; ++id) {
+			if (match(id, pattern, m, prefix)) {
+				cb(id + 1, &map[entry_off[id]], entry_len[id]);
+				++found;
+			}
+		}
+		return found;
+	}
+
+	// candidates come from the rarest trigram of the pattern
+	struct posting *best = NULL;
+	for (size_t i = 0; i + 3 <= m; ++i) {
+		struct posting *p = table_find(trigram(&pattern[i]));
+		if (p == NULL)
+			return 0;
+		if (best == NULL || p->n < best->n)
+			best = p;
+	}
+	for (uint32_t i = 0; i < best->n; ++i) {
+		uint32_t id = best->ids[i];
+		if (match(id, pattern, m, prefix)) {
+			cb(id + 1, &map[entry_off[id]], entry_len[id]);
+			++found;
+		}
+	}
+	return found;
+}
+
+void history_close()
+{
+	history_drop_index();
+	if (hist_fd >= 0)
+		close(hist_fd);
+	hist_fd = -1;
+}
@@ -0,0 +1,270 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include "../include/lexer.h"
+
+// bytes that end a run of plain word characters outside quotes
+static const bool special[256] = {
+	['\0'] = true, [' '] = true, ['\t'] = true, ['\n'] = true,
+	['\r'] = true, ['|'] = true,  ['<'] = true,  ['>'] = true,
+	['\''] = true, ['"'] = true,  ['\\'] = true, ['$'] = true,
+	[';'] = true,  ['&'] = true,  ['('] = true,  [')'] = true,
+};
+
+static bool is_blank(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static bool is_operator(const char *r)
+{
+	return r[0] == '|' || r[0] == '<' || r[0] == '>' || r[0] == ';' ||
+	       r[0] == '\n' || r[0] == '(' || r[0] == ')' ||
+	       (r[0] == '&' && r[1] == '&');
+}
+
+void lex_init(struct lexer *lx, char *line)
+{
+	lx->r = line;
+	lx->pending = TOK_END;
+	lx->err = NULL;
+}
+
+/**
+ * @brief Find the ')' closing a "$(" command substitution
+ * Quotes and nested parentheses inside are skipped, the bytes are not
+ * modified so the command can be parsed again when it runs
+ * @param p Points just after "$("
+ * @return char* 
+ * Return the closing ')', NULL if it is missing
+ */
+char *lex_skip_subst(char *p)
+{
+	int depth = 1;
+	for (; *p; ++p) {
+		if (*p == '\\' && p[1]) {
+			++p;
+		} else if (*p == '\'' || *p == '"') {
+			char q = *p;
+			while (*++p && *p != q)
+				if (q == '"' && *p == '\\' && p[1])
+					++p;
+			if (*p == '\0')
+				return NULL;
+		} else if (*p == '(') {
+			++depth;
+		} else if (*p == ')' && --depth == 0) {
+			return p;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief Consume the operator at lx->r
+ * 
+ * @param lx Lexer state
+ * @param word_start The operator starts a word, so "2>" is a redirection
+ * @return enum token_type 
+ * Return TOK_END if there is no operator at lx->r
+ */
+static enum token_type lex_operator(struct lexer *lx, bool word_start)
+{
+	char *r = lx->r;
+
+	if (word_start && r[0] == '2' && r[1] == '>') {
+		if (r[2] == '&' && r[3] == '1') {
+			lx->r += 4;
+			return TOK_ERR_TO_OUT;
+		}
+		if (r[2] == '>') {
+			lx->r += 3;
+			return TOK_ERR_APPEND;
+		}
+		lx->r += 2;
+		return TOK_ERR;
+	}
+	switch (r[0]) {
+	case '|':
+		lx->r += r[1] == '|' ? 2 : 1;
+		return r[1] == '|' ? TOK_OR : TOK_PIPE;
+	case '&':
+		if (r[1] != '&')
+			break;
+		lx->r += 2;
+		return TOK_AND;
+	case ';':
+		lx->r += 1;
+		return TOK_SEMI;
+	case '\n':
+		lx->r += 1;
+		return TOK_NEWLINE;
+	case '(':
+		lx->r += 1;
+		return TOK_LPAREN;
+	case ')':
+		lx->r += 1;
+		return TOK_RPAREN;
+	case '>':
+		lx->r += r[1] == '>' ? 2 : 1;
+		return r[1] == '>' ? TOK_APPEND : TOK_OUT;
+	case '<':
+		if (r[1] == '<' && r[2] == '<') {
+			lx->r += 3;
+			return TOK_HERE_STR;
+		}
+		lx->r += r[1] == '<' ? 2 : 1;
+		return r[1] == '<' ? TOK_HERE_DOC : TOK_IN;
+	}
+	return TOK_END;
+}
+
+/**
+ * @brief Return the next token of the line
+ * Single pass state machine: unquoted, '...' and "..." states, with
+ * backslash escapes outside single quotes. Quotes and escapes are
+ * replaced in place by the CTL_* markers, the expansion stage removes
+ * them once it knows which bytes were quoted. "$(...)" is kept raw
+ * @param lx Lexer state
+ * @param word Set to the word for TOK_WORD
+ * @return enum token_type 
+ * Return the token type, TOK_ERROR with lx->err set on bad input
+ */
+enum token_type lex_next(struct lexer *lx, char **word)
+{
+	enum token_type type = lx->pending;
+	if (type != TOK_END) {
+		lx->pending = TOK_END;
+		return type;
+	}
+
+	while (is_blank(*lx->r))
+		++lx->r;
+	if (*lx->r == '#') // comment up to the end of the line
+		while (*lx->r && *lx->r != '\n')
+			++lx->r;
+	if (*lx->r == '\0')
+		return TOK_END;
+	if ((type = lex_operator(lx, true)) != TOK_END)
+		return type;
+
+	enum { UNQUOTED, SINGLE, DOUBLE } state = UNQUOTED;
+	char *r = lx->r;
+	*word = r;
+	while (true) {
+		char c = *r;
+		if (state == UNQUOTED && !special[(unsigned char)c]) {
+			while (!special[(unsigned char)*++r])
+				;
+			continue;
+		}
+		if (c == '\0') {
+			if (state != UNQUOTED) {
+				lx->err = "unterminated quote";
+				return TOK_ERROR;
+			}
+			break;
+		}
+		if (c == '$' && r[1] == '(' && state != SINGLE) {
+			char *end = lex_skip_subst(r + 2);
+			if (end == NULL) {
+				lx->err = "unterminated command substitution";
+				return TOK_ERROR;
+			}
+			r = end + 1;
+		} else if (state == SINGLE) {
+			if (c == '\'') {
+				*r = CTL_QUOTE;
+				state = UNQUOTED;
+			}
+			++r;
+		} else if (state == DOUBLE) {
+			if (c == '"') {
+				*r = CTL_DQUOTE;
+				state = UNQUOTED;
+			} else if (c == '\\' &&
+				   (r[1] == '"' || r[1] == '\\' || r[1] == '$' ||
+				    r[1] == '`')) {
+				*r++ = CTL_ESC;
+			}
+			++r;
+		} else if (is_blank(c)) {
+			*r++ = '\0';
+			break;
+		} else if (is_operator(r)) {
+			// read the operator before its first byte is overwritten
+			lx->r = r;
+			lx->pending = lex_operator(lx, false);
+			*r = '\0';
+			r = lx->r;
+			break;
+		} else if (c == '\'') {
+			*r++ = CTL_QUOTE;
+			state = SINGLE;
+		} else if (c == '"') {
+			*r++ = CTL_DQUOTE;
+			state = DOUBLE;
+		} else if (c == '\\') {
+			if (r[1] != '\0')
+				*r++ = CTL_ESC;
+			++r;
+		} else { // a '$' that doesn't start "$(", a single '&'
+			++r;
+		}
+	}
+	lx->r = r;
+	return TOK_WORD;
+}
+
+/**
+ * @brief Remove the CTL_* markers of a word in place
+ * Used where no expansion applies, e.g. a here-document delimiter
+ * @param word Word returned by lex_next()
+ * @return char* 
+ * Return word
+ */
+char *lex_unquote(char *word)
+{
+	char *w = word;
+	for (char *r = word; *r; ++r) {
+		if (*r == CTL_ESC && r[1])
+			*w++ = *++r;
+		else if (*r != CTL_QUOTE && *r != CTL_DQUOTE)
+			*w++ = *r;
+	}
+	*w = '\0';
+	return word;
+}
+
+const char *token_name(enum token_type type)
+{
+	static const char *names[] = {
+		"end of input", "word", "|", "<", ">", ">>", "2>", "2>>",
+		"2>&1", "<<<", "<<", ";", "newline", "&&", "||", "(", ")",
+		"error",
+	};
+	return names[type];
+}
+
+void ts_init(struct token_stream *ts, char *line)
+{
+	lex_init(&ts->lx, line);
+	ts->peeked = false;
+}
+
+enum token_type ts_peek(struct token_stream *ts, char **word)
+{
+	if (!ts->peeked) {
+		ts->type = lex_next(&ts->lx, &ts->word);
+		ts->peeked = true;
+	}
+	if (word)
+		*word = ts->word;
+	return ts->type;
+}
+
+enum token_type ts_next(struct token_stream *ts, char **word)
+{
+	enum token_type type = ts_peek(ts, word);
+	ts->peeked = false;
+	return type;
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -5,28 +6,78 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
 #include <fcntl.h>
+#include <ctype.h>
+#include <errno.h>
 #include "../include/command.h"
+#include "../include/shell.h"
 #include "../include/builtin.h"
+#include "../include/zcopy.h"
+#include "../include/expand.h"
+#include "../include/ast.h"
+
+int last_status = 0;
+bool shell_exit = false;
 
 // ======================= requirement 2.3 =======================
+/**
+ * @brief 
+ * Put a here-string or here-document body on stdin
+ * The body is stored in a memfd, so it can be larger than a pipe buffer
+ * and the reader can mmap it like a regular file
+ * @param body Content to read from stdin
+ * @return int 
+ * Return 0, -1 on failure
+ */
+static int here_doc_stdin(const char *body)
+{
+	size_t len = strlen(body);
+	int fd = memfd_create("here-doc", MFD_CLOEXEC);
+	if (fd < 0) {
+		perror("memfd_create");
+		return -1;
+	}
+	for (size_t done = 0; done < len;) {
+		ssize_t n = write(fd, body + done, len - done);
+		if (n < 0) {
+			perror("here-doc");
+			close(fd);
+			return -1;
+		}
+		done += n;
+	}
+	lseek(fd, 0, SEEK_SET);
+	dup2(fd, STDIN_FILENO);
+	close(fd);
+	return 0;
+}
+
 /**
  * @brief 
  * Redirect command's stdin and stdout to the specified file descriptor
  * If you want to implement ( < , > ), use "in_file" and "out_file" included the cmd_node structure
  * If you want to implement ( | ), use "in" and "out" included the cmd_node structure.
+ * ( << , <<< ) come from "here_doc" and "here_str", ( >> ) from "append",
+ * ( 2> , 2>> , 2>&1 ) from "err_file", "err_append" and "err_to_out"
+ * stderr is redirected after stdout, so "2>&1" follows a "> file"
  *
  * @param p cmd_node structure
- * 
+ * @return int 
+ * Return 0, -1 if a file could not be opened
  */
-void redirection(struct cmd_node *p)
+int redirection(struct cmd_node *p)
 {
 	// in file
-	if (p->in_file) {
+	if (p->here_doc || p->here_str) {
+		if (here_doc_stdin(p->here_doc ? p->here_doc : p->here_str) < 0)
+			return -1;
+	} else if (p->in_file) {
 		int fd = open(p->in_file, O_RDONLY);
 		if (fd < 0) {
 			perror(p->in_file);
-			exit(EXIT_FAILURE);
+			return -1;
 		}
 		dup2(fd, STDIN_FILENO);
 		close(fd);
@@ -35,20 +86,125 @@ void redirection(struct cmd_node *p)
 	}
 	// out file
 	if (p->out_file) {
-		int fd = open(p->out_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		int flags = O_WRONLY | O_CREAT | (p->append ? O_APPEND : O_TRUNC);
+		int fd = open(p->out_file, flags, 0644);
 		if (fd < 0) {
 			perror(p->out_file);
-			exit(EXIT_FAILURE);
+			return -1;
 		}
 		dup2(fd, STDOUT_FILENO);
 		close(fd);
 	} else if (p->out != STDOUT_FILENO) {
 		dup2(p->out, STDOUT_FILENO);
 	}
+	// error file
+	if (p->err_to_out) {
+		dup2(STDOUT_FILENO, STDERR_FILENO);
+	} else if (p->err_file) {
+		int flags = O_WRONLY | O_CREAT |
+			    (p->err_append ? O_APPEND : O_TRUNC);
+		int fd = open(p->err_file, flags, 0644);
+		if (fd < 0) {
+			perror(p->err_file);
+			return -1;
+		}
+		dup2(fd, STDERR_FILENO);
+		close(fd);
+	}
+	return 0;
 }
 // ===============================================================
 
 // ======================= requirement 2.2 =======================
+/**
+ * @brief 
+ * Fork a child for the command without waiting for it
+ * The child runs "redirection()" and then "execvp()", or the built-in
+ * command, function or compound command itself (e.g. a pipeline stage
+ * "echo", "record" or "for ... done")
+ * @param p cmd_node structure
+ * @return pid_t 
+ * Return child pid, -1 if "fork()" failed
+ */
+pid_t fork_proc(struct cmd_node *p)
+{
+	// the child inherits stdio buffers, don't let it replay the prompt
+	fflush(stdout);
+	p->start = usage_now();
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return -1;
+	} else if (pid == 0) { // child
+		// "NAME=value cmd" only changes the environment of cmd
+		for (int i = 0; i < p->vars_num; ++i)
+			putenv(p->vars[i]);
+		if (redirection(p) < 0)
+			_exit(EXIT_FAILURE);
+		// O_CLOEXEC only helps stages that exec: a compound stage,
+		// function or built-in would keep the read end of its own
+		// output open and never get SIGPIPE once the reader is gone
+		if (p->in != STDIN_FILENO)
+			close(p->in);
+		if (p->out != STDOUT_FILENO)
+			close(p->out);
+		if (p->next)
+			close(p->next->in);
+		int status;
+		struct func *func;
+		if (p->body) {
+			status = ast_exec(p->body);
+			fflush(stdout);
+			_exit(status);
+		}
+		// expanded to no words: the assignments and redirections
+		// above were all there was to do
+		if (p->length == 0)
+			_exit(0);
+		// functions first, a function named cat replaces it here too
+		if ((func = func_lookup(p->args[0])) != NULL) {
+			status = func_call(func, p->args);
+			fflush(stdout);
+			_exit(status);
+		}
+		// plain "cat" moves data with splice/copy_file_range
+		if ((status = zcopy_cat(p->args)) != -1)
+			_exit(status);
+		int builtin = searchBuiltInCommand(p);
+		if (builtin != -1) {
+			status = execBuiltInCommand(builtin, p);
+			fflush(stdout);
+			_exit(status < 0 ? EXIT_FAILURE : status);
+		}
+		execvp(p->args[0], p->args);
+		perror("execvp");
+		exit(EXIT_FAILURE);
+	}
+	p->pid = pid;
+	return pid;
+}
+
+/**
+ * @brief 
+ * Wait for the child of fork_proc() with "wait4()" and keep its
+ * resource usage in p->usage
+ * @param p cmd_node structure
+ * @return int 
+ * Return the raw wait status
+ */
+int wait_proc(struct cmd_node *p)
+{
+	int status;
+	struct rusage ru;
+	if (wait4(p->pid, &status, 0, &ru) < 0) {
+		perror("wait4");
+		return -1;
+	}
+	usage_from_rusage(&p->usage, &ru);
+	p->usage.wall = usage_now() - p->start;
+	return status;
+}
+
 /**
  * @brief 
  * Execute external command
@@ -61,48 +217,142 @@ void redirection(struct cmd_node *p)
  */
 int spawn_proc(struct cmd_node *p)
 {
-	pid_t pid = fork();
-	if (pid < 0) {
-		perror("fork");
+	if (fork_proc(p) < 0)
 		return -1;
-	} else if (pid == 0) { // child
-		redirection(p);
-		int status = execvp(p->args[0], p->args);
-		if (status < 0) {
-			perror("execvp");
-			exit(EXIT_FAILURE);
-		}
-	} else { // parent
-		int status;
-		waitpid(pid, &status, 0);
-		return status;
-	}
-	return 0;
+	return wait_proc(p);
 }
 // ===============================================================
 
 // ======================= requirement 2.4 =======================
 /**
  * @brief 
- * Use "pipe()" to create a communication bridge between processes
- * Call "spawn_proc()" in order according to the number of cmd_node
+ * Parse a pipe size such as "1048576", "256K" or "1M"
+ * @param s Size, "" or "default" for the kernel default
+ * @return long 
+ * Return bytes, 0 for the default, -1 if s is not a size
+ */
+static long parse_size(const char *s)
+{
+	char *end;
+	if (*s == '\0' || strcmp(s, "default") == 0)
+		return 0;
+	long n = strtol(s, &end, 10);
+	switch (toupper((unsigned char)*end)) {
+	case 'G':
+		n <<= 10;
+		// fall through
+	case 'M':
+		n <<= 10;
+		// fall through
+	case 'K':
+		n <<= 10;
+		++end;
+	}
+	return (n < 0 || end == s || *end) ? -1 : n;
+}
+
+/**
+ * @brief 
+ * Pipe capacity for the pipeline: "PIPESIZE=..." before its first
+ * command, else $PIPESIZE
+ * @param cmd Command structure
+ * @return long 
+ * Return bytes, 0 for the kernel default
+ */
+long pipeline_pipe_size(struct cmd *cmd)
+{
+	const size_t len = strlen(PIPESIZE_ENV "=");
+	const char *val = NULL;
+
+	for (int i = 0; i < cmd->head->vars_num; ++i)
+		if (strncmp(cmd->head->vars[i], PIPESIZE_ENV "=", len) == 0)
+			val = cmd->head->vars[i] + len;
+	if (val == NULL && (val = getenv(PIPESIZE_ENV)) == NULL)
+		return 0;
+
+	long size = parse_size(val);
+	if (size < 0) {
+		fprintf(stderr, "%s: invalid pipe size `%s'\n", PIPESIZE_ENV,
+			val);
+		return 0;
+	}
+	return size;
+}
+
+/**
+ * @brief 
+ * "pipe2(O_CLOEXEC)" with a capacity of size bytes
+ * O_CLOEXEC drops the pipe ends a stage inherits when it execs, but a
+ * stage run by the shell itself never execs: fork_proc() closes them
+ * explicitly after redirection(). A size above fs.pipe-max-size is
+ * lowered to it
+ * @param fd Pipe ends
+ * @param size Capacity, 0 keeps the kernel default (64KB)
+ * @return int 
+ * Return 0, -1 if the pipe could not be created
+ */
+static int make_pipe(int fd[2], long size)
+{
+	static long max_size = -1;
+
+	if (pipe2(fd, O_CLOEXEC) < 0) {
+		perror("pipe2");
+		return -1;
+	}
+	if (size == 0)
+		return 0;
+	if (max_size > 0 && size > max_size)
+		size = max_size;
+	if (fcntl(fd[1], F_SETPIPE_SZ, size) >= 0)
+		return 0;
+	if (errno == EPERM && max_size < 0) {
+		// unprivileged: retry once at the system limit
+		FILE *fp = fopen("/proc/sys/fs/pipe-max-size", "r");
+		if (fp && fscanf(fp, "%ld", &max_size) != 1)
+			max_size = 0;
+		if (fp)
+			fclose(fp);
+		if (max_size > 0 && max_size < size &&
+		    fcntl(fd[1], F_SETPIPE_SZ, max_size) >= 0)
+			return 0;
+	}
+	perror("F_SETPIPE_SZ");
+	return 0;
+}
+
+/**
+ * @brief 
+ * Use "pipe2()" to create a communication bridge between processes
+ * Fork every cmd_node first so the stages run concurrently, then reap
+ * them in order. High-volume pipelines can raise the pipe capacity
+ * with PIPESIZE, so stages move bigger chunks per context switch
  * @param cmd Command structure  
  * @return int
- * Return execution status 
+ * Return execution status of the last stage
  */
 int fork_cmd_node(struct cmd *cmd)
 {
-	struct cmd_node *p = cmd->head;
+	struct cmd_node *p;
+	long size = pipeline_pipe_size(cmd);
+	// a cached tree runs the same nodes again
+	for (p = cmd->head; p; p = p->next)
+		p->pid = -1;
+	p = cmd->head;
 	while (p) {
 		if (p->next) {
 			int fd[2];
-			pipe(fd);
+			if (make_pipe(fd, size) < 0) {
+				if (p != cmd->head)
+					close(p->in);
+				break;
+			}
 
 			p->out = fd[1];
 			p->next->in = fd[0];
+			cmd->pipe_size = fcntl(fd[1], F_GETPIPE_SZ);
 		}
 
-		spawn_proc(p);
+		fork_proc(p);
 
 		if (p != cmd->head)
 			close(p->in);
@@ -111,67 +361,331 @@ int fork_cmd_node(struct cmd *cmd)
 
 		p = p->next;
 	}
-	return 0;
+
+	int status = -1;
+	for (p = cmd->head; p; p = p->next)
+		if (p->pid > 0)
+			status = wait_proc(p);
+	return status;
 }
 // ===============================================================
 
+/**
+ * @brief 
+ * Run a built-in command, a function or a compound command inside the
+ * shell process
+ * The shell's stdio is only saved when the node redirects it, so a loop
+ * of built-ins costs no system calls besides their own work
+ * @param p cmd_node structure
+ * @param builtin Index returned by searchBuiltInCommand(), or -1
+ * @param func Function to call, or NULL for p->body
+ * @param account Measure usage with "getrusage(RUSAGE_SELF)"
+ * @return int 
+ * Return execution status
+ */
+static int run_in_shell(struct cmd_node *p, int builtin, struct func *func,
+			bool account)
+{
+	struct rusage before, after;
+	bool in_redir = p->in_file || p->here_doc || p->here_str,
+	     out_redir = p->out_file != NULL,
+	     err_redir = p->err_file || p->err_to_out;
+	int in = -1, out = -1, err = -1, status;
+
+	if (in_redir && (in = dup(STDIN_FILENO)) == -1)
+		perror("dup");
+	if (out_redir && (out = dup(STDOUT_FILENO)) == -1)
+		perror("dup");
+	if (err_redir && (err = dup(STDERR_FILENO)) == -1)
+		perror("dup");
+
+	if (account) {
+		getrusage(RUSAGE_SELF, &before);
+		p->start = usage_now();
+	}
+	// the prompt is still buffered, it must not land in the out file
+	if (out_redir || err_redir)
+		fflush(stdout);
+	if (redirection(p) < 0)
+		status = 1;
+	else if (builtin != -1)
+		status = execBuiltInCommand(builtin, p);
+	else if (func)
+		status = func_call(func, p->args);
+	else
+		status = ast_exec(p->body);
+	if (account) {
+		fflush(stdout);
+		p->usage.wall = usage_now() - p->start;
+		getrusage(RUSAGE_SELF, &after);
+		usage_diff(&p->usage, &before, &after);
+	}
+
+	// recover shell stdin, stdout and stderr
+	if (in_redir) {
+		dup2(in, 0);
+		close(in);
+	}
+	if (out_redir) {
+		fflush(stdout);
+		dup2(out, 1);
+		close(out);
+	}
+	if (err_redir) {
+		fflush(stderr);
+		dup2(err, 2);
+		close(err);
+	}
+	return status;
+}
+
+/**
+ * @brief 
+ * Print the usage of every stage and of the whole pipeline to stderr,
+ * the summary is also added to the line's entry for "record". A
+ * pipeline also gets its pipe size and the context switches of all its
+ * stages together
+ * @param cmd Command structure
+ * @param print Whether to print the report
+ * @param keep Add it to the history entry: not a command run inside
+ * another one that is accounted already
+ */
+static void account_usage(struct cmd *cmd, bool print, bool keep)
+{
+	struct proc_usage total;
+	char label[64];
+	int stage = 0;
+
+	memset(&total, 0, sizeof(total));
+	for (struct cmd_node *p = cmd->head; p; p = p->next, ++stage) {
+		if (print && cmd->head->next) {
+			snprintf(label, sizeof(label), "[%d] %.40s", stage,
+				 p->length ? p->args[0] : "(compound)");
+			usage_print(stderr, label, &p->usage);
+		}
+		usage_add(&total, &p->usage);
+	}
+	if (print && total.stages > 0)
+		usage_print(stderr, "[time]", &total);
+	// the raw total: what PIPESIZE saves over default pipes is measured
+	// by "make bench", which runs the same pipeline both ways
+	if (print && cmd->head->next)
+		fprintf(stderr,
+			"[pipe] %d pipes of %ldKB, %ld context switches in total "
+			"(saving: make bench)\n",
+			cmd->pipe_num, cmd->pipe_size >> 10,
+			total.nvcsw + total.nivcsw);
+	if (keep && history_count > 0) {
+		struct proc_usage *line =
+			&history_usage[(history_count - 1) % MAX_RECORD_NUM];
+		// the commands of a line run one after the other
+		double wall = line->wall + total.wall;
+		usage_add(line, &total);
+		line->wall = wall;
+	}
+}
+
+/**
+ * @brief 
+ * Convert a wait status (or a built-in return value) to an exit code
+ * @param status Raw status
+ * @param builtin The status comes from a built-in run in the shell
+ * @return int 
+ */
+static int exit_code(int status, bool builtin)
+{
+	if (builtin || status < 0)
+		return status < 0 ? 1 : status;
+	if (WIFSIGNALED(status))
+		return 128 + WTERMSIG(status);
+	return WEXITSTATUS(status);
+}
+
+/**
+ * @brief 
+ * Set "NAME=value" words in the shell's own environment
+ * @param p cmd_node structure
+ */
+static void assign_vars(struct cmd_node *p)
+{
+	for (int i = 0; i < p->vars_num; ++i) {
+		char *eq = strchr(p->vars[i], '=');
+		*eq = '\0';
+		setenv(p->vars[i], eq + 1, 1);
+		*eq = '=';
+	}
+}
+
+/**
+ * @brief 
+ * Expand and execute a parsed command
+ * A single built-in command, function call or compound command runs in
+ * the shell process, anything else is forked
+ * @param cmd Command structure
+ * @return int 
+ * Return the exit code, also kept in last_status for "$?"
+ */
+int run_cmd(struct cmd *cmd)
+{
+	int status = -1;
+	bool builtin = false, account = cmd->timed || usage_always;
+	// only a single command
+	struct cmd_node *temp = cmd->head;
+	// commands inside a function or compound command run in the shell
+	// are part of its usage already
+	static int depth = 0;
+	bool outer = depth++ == 0;
+
+	if (expand_cmd(cmd) < 0) {
+		status = -1;
+	} else if (temp->body && temp->next == NULL) {
+		builtin = true;
+		status = run_in_shell(temp, -1, NULL, account);
+	} else if (temp->length == 0 && temp->next == NULL) {
+		assign_vars(temp);
+		builtin = true;
+		status = 0;
+		if (cmd->timed)
+			fprintf(stderr, "time: missing command\n");
+	} else if (temp->next == NULL) {
+		// functions take precedence over built-ins
+		struct func *func = func_lookup(temp->args[0]);
+		status = func ? -1 : searchBuiltInCommand(temp);
+		if ((func || status != -1) && temp->vars_num == 0) {
+			if (strcmp(temp->args[0], "exit") == 0 && !func)
+				shell_exit = true;
+			builtin = true;
+			status = run_in_shell(temp, status, func, account);
+		} else {
+			//external command
+			status = spawn_proc(cmd->head);
+		}
+	}
+	// There are multiple commands ( | )
+	else {
+		status = fork_cmd_node(cmd);
+	}
+	--depth;
+	if (account)
+		account_usage(cmd, cmd->timed, outer);
+	last_status = exit_code(status, builtin);
+	return last_status;
+}
+
+/**
+ * @brief 
+ * Parse and run an input, asking "more" for the rest of a compound
+ * command that spans several lines
+ * @param line First line of the input
+ * @param more Returns the next line, NULL when there is none
+ * @return int 
+ * Return the exit code
+ */
+static int run_program(char *line, char *(*more)())
+{
+	struct program prog;
+	if (ast_parse(&prog, line, more) < 0)
+		return last_status = 2;
+	if (ast_read_here_docs(prog.root) < 0)
+		last_status = 1;
+	else
+		ast_exec(prog.root);
+	// "break" or "return" with nothing left to leave
+	flow = FLOW_NONE;
+	program_free(&prog);
+	return last_status;
+}
+
+/**
+ * @brief 
+ * Parse and run one command line
+ * @param line Command line
+ * @return int 
+ * Return the exit code
+ */
+int run_line(char *line)
+{
+	return run_program(line, NULL);
+}
+
+/**
+ * @brief 
+ * "$(line)": run line in a forked copy of the shell and capture stdout
+ * @param line Command line
+ * @return char* 
+ * Return the output without trailing newlines, NULL on failure
+ */
+char *command_subst(char *line)
+{
+	int fd[2];
+	if (pipe(fd) < 0) {
+		perror("pipe");
+		return NULL;
+	}
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		close(fd[0]);
+		close(fd[1]);
+		return NULL;
+	} else if (pid == 0) {
+		close(fd[0]);
+		dup2(fd[1], STDOUT_FILENO);
+		close(fd[1]);
+		int code = run_line(line);
+		fflush(stdout);
+		_exit(code);
+	}
+	close(fd[1]);
+
+	size_t len = 0, cap = BUF_SIZE;
+	char *buf = (char *)malloc(cap);
+	ssize_t n;
+	while ((n = read(fd[0], buf + len, cap - len - 1)) > 0) {
+		len += n;
+		if (len + 1 == cap)
+			buf = (char *)realloc(buf, cap *= 2);
+	}
+	close(fd[0]);
+	int status;
+	waitpid(pid, &status, 0);
+	last_status = exit_code(status, false);
+
+	while (len > 0 && buf[len - 1] == '\n')
+		--len;
+	buf[len] = '\0';
+	return buf;
+}
+
+/**
+ * @brief 
+ * Continuation line of a compound command
+ * @return char* 
+ * Return the line, NULL at the end of the input
+ */
+static char *read_more()
+{
+	char *line;
+	do {
+		printf("> ");
+		line = read_line();
+	} while (line == NULL && !feof(stdin));
+	return line;
+}
+
 void shell()
 {
-	while (1) {
+	while (!shell_exit) {
 		printf(">>> $ ");
 		char *buffer = read_line();
-		if (buffer == NULL)
+		if (buffer == NULL) {
+			if (feof(stdin))
+				break;
 			continue;
-
-		struct cmd *cmd = split_line(buffer);
-
-		int status = -1;
-		bool should_exit = false;
-		// only a single command
-		struct cmd_node *temp = cmd->head;
-
-		if (temp->next == NULL) {
-			status = searchBuiltInCommand(temp);
-			if (status != -1) {
-				bool is_exit_cmd =
-					strcmp(temp->args[0], "exit") == 0;
-				int in = dup(STDIN_FILENO),
-				    out = dup(STDOUT_FILENO);
-				if ((in == -1) | (out == -1))
-					perror("dup");
-				redirection(temp);
-				status = execBuiltInCommand(status, temp);
-
-				// recover shell stdin and stdout
-				if (temp->in_file)
-					dup2(in, 0);
-				if (temp->out_file) {
-					dup2(out, 1);
-				}
-				close(in);
-				close(out);
-				if (is_exit_cmd)
-					should_exit = true;
-			} else {
-				//external command
-				status = spawn_proc(cmd->head);
-			}
-		}
-		// There are multiple commands ( | )
-		else {
-			status = fork_cmd_node(cmd);
-		}
-		// free space
-		while (cmd->head) {
-			struct cmd_node *temp = cmd->head;
-			cmd->head = cmd->head->next;
-			free(temp->args);
-			free(temp);
 		}
-		free(cmd);
-		free(buffer);
 
-		if (should_exit)
-			break;
+		run_program(buffer, read_more);
+		free(buffer);
 	}
 }
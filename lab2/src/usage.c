@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "../include/usage.h"
+
+// "timing on": keep the usage of every command in the record history
+bool usage_always = false;
+
+static double tv_sec(const struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/**
+ * @brief Monotonic clock in seconds, used for wall time
+ * 
+ * @return double 
+ */
+double usage_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Fill u with the rusage of one reaped child
+ * The wall time is left untouched, the caller measures it
+ * @param u Usage of the command
+ * @param ru Result of "wait4()"
+ */
+void usage_from_rusage(struct proc_usage *u, const struct rusage *ru)
+{
+	u->stages = 1;
+	u->utime = tv_sec(&ru->ru_utime);
+	u->stime = tv_sec(&ru->ru_stime);
+	u->maxrss = ru->ru_maxrss;
+	u->minflt = ru->ru_minflt;
+	u->majflt = ru->ru_majflt;
+	u->nvcsw = ru->ru_nvcsw;
+	u->nivcsw = ru->ru_nivcsw;
+}
+
+/**
+ * @brief Usage of a built-in command run inside the shell process
+ * The counters are the difference of two "getrusage(RUSAGE_SELF)" calls,
+ * max RSS is the shell's own peak
+ * @param u Usage of the command
+ * @param before Snapshot taken before the built-in command
+ * @param after Snapshot taken after the built-in command
+ */
+void usage_diff(struct proc_usage *u, const struct rusage *before,
+		const struct rusage *after)
+{
+	u->stages = 1;
+	u->utime = tv_sec(&after->ru_utime) - tv_sec(&before->ru_utime);
+	u->stime = tv_sec(&after->ru_stime) - tv_sec(&before->ru_stime);
+	u->maxrss = after->ru_maxrss;
+	u->minflt = after->ru_minflt - before->ru_minflt;
+	u->majflt = after->ru_majflt - before->ru_majflt;
+	u->nvcsw = after->ru_nvcsw - before->ru_nvcsw;
+	u->nivcsw = after->ru_nivcsw - before->ru_nivcsw;
+}
+
+/**
+ * @brief Accumulate the usage of one pipeline stage
+ * Stages run concurrently, so wall time and max RSS take the maximum
+ * @param sum Usage of the whole pipeline
+ * @param u Usage of one stage
+ */
+void usage_add(struct proc_usage *sum, const struct proc_usage *u)
+{
+	sum->stages += u->stages;
+	if (u->wall > sum->wall)
+		sum->wall = u->wall;
+	sum->utime += u->utime;
+	sum->stime += u->stime;
+	if (u->maxrss > sum->maxrss)
+		sum->maxrss = u->maxrss;
+	sum->minflt += u->minflt;
+	sum->majflt += u->majflt;
+	sum->nvcsw += u->nvcsw;
+	sum->nivcsw += u->nivcsw;
+}
+
+void usage_print(FILE *fp, const char *label, const struct proc_usage *u)
+{
+	fprintf(fp,
+		"%s real %.6fs user %.6fs sys %.6fs maxrss %ldKB "
+		"minflt %ld majflt %ld nvcsw %ld nivcsw %ld\n",
+		label, u->wall, u->utime, u->stime, u->maxrss, u->minflt,
+		u->majflt, u->nvcsw, u->nivcsw);
+}
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Pipeline regressions: ./tests/pipeline_test.sh [shell], from lab2/
+# Every case is one input line for the shell, what it must print, and a
+# time limit, so a hung pipeline fails instead of blocking the run.
+
+SHELL_BIN=${1:-./my_shell}
+MY_SHELL_HISTFILE=$(mktemp)
+export MY_SHELL_HISTFILE
+out=$(mktemp)
+failed=0
+
+check() {
+	name=$1 line=$2 want=$3
+	printf '%s\nexit\n' "$line" | timeout 5 "$SHELL_BIN" >"$out" 2>&1
+	status=$?
+	got=$(sed 's/>>> \$ //g' "$out" | grep -v '^$')
+	if [ $status -eq 124 ]; then
+		echo "FAIL $name: still running after 5s"
+		failed=1
+	elif [ "$got" != "$want" ]; then
+		echo "FAIL $name: got '$got', want '$want'"
+		failed=1
+	else
+		echo "ok   $name"
+	fi
+}
+
+# a stage that never execs must still get SIGPIPE when its reader exits
+check "loop into head" 'while true; do echo y; done | head -1' 'y'
+check "function into head" \
+	'f() { while true; do echo z; done; }; f | head -2' 'z
+z'
+check "exec stage into head" 'yes | head -1' 'y'
+
+# a stage that expands to no words does nothing and succeeds
+check "empty last stage" 'echo a | $EMPTY; echo $?' '0'
+check "empty first stage" '$EMPTY | cat; echo $?' '0'
+
+rm -f "$MY_SHELL_HISTFILE" "$out"
+exit $failed
@@ -3,6 +3,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include "../spin.h"
 
 /*Note: Value of LOCK is 0 and value of UNLOCK is 1.*/
 #define LOCK 0
@@ -14,27 +15,16 @@ pthread_mutex_t mutex;
 
 void spin_lock()
 {
-	asm volatile("loop:\n\t"
-		     "mov $0, %%eax\n\t"
-		     /*YOUR CODE HERE*/
-		     "xchg %%eax, %[lock]\n\t"
-		     "sub $1, %%eax\n\t"
-		     /****************/
-		     "js loop\n\t"
-		     :
-		     : [lock] "m"(lock)
-		     : "eax", "memory");
+	/*YOUR CODE HERE*/
+	ttas_spin_lock(&lock);
+	/****************/
 }
 
 void spin_unlock()
 {
-	asm volatile("mov $1, %%eax\n\t"
-		     /*YOUR CODE HERE*/
-		     "xchg %%eax, %[lock]\n\t"
-		     /****************/
-		     :
-		     : [lock] "m"(lock)
-		     : "eax", "memory");
+	/*YOUR CODE HERE*/
+	spin_unlock_store(&lock);
+	/****************/
 }
 
 void *thread(void *arg)
@@ -0,0 +1,199 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "../spin.h"
+#include "../../lock/ticket.h"
+
+/*
+ * Shared counter benchmark
+ *
+ * Every primitive protects (or replaces) the "a = a + 1" of 1_1.c and
+ * 1_2.c; "xchg" is the original lock of 1_2.c and "ttas_backoff" the
+ * one it uses now (../spin.h). For each thread count from 1 to the
+ * number of cores, the threads increment for a fixed time and the run
+ * reports the total throughput and how evenly the increments were
+ * spread over threads: Jain's index (1 = perfectly fair, 1/n = one
+ * thread did everything) and the min/max per-thread ratio.
+ *
+ * usage: counter_bench [max_threads] [ms_per_run]
+ */
+
+#define CACHE_LINE 64
+#define MAX_THREADS 256
+
+struct worker {
+	pthread_t tid;
+	int id;
+	long ops;
+} __attribute__((aligned(CACHE_LINE)));
+
+struct shard {
+	volatile long v;
+} __attribute__((aligned(CACHE_LINE)));
+
+static volatile long a;
+static volatile bool stop;
+static pthread_barrier_t start;
+static int nthreads, ncpus;
+
+static pthread_spinlock_t spin;
+static volatile int xchg_lock_var = 1; // 1_2.c: UNLOCK is 1
+static volatile int ttas_lock_var = 1;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct ticket_lock ticket; // zeroed, same as ticket_init()
+static struct shard shards[MAX_THREADS];
+
+static inline bool running()
+{
+	return !__atomic_load_n(&stop, __ATOMIC_RELAXED);
+}
+
+#define WORKER(name, body)                                  \
+	static void *name(void *arg)                        \
+	{                                                   \
+		struct worker *w = (struct worker *)arg;    \
+		long ops = 0;                               \
+		pthread_barrier_wait(&start);               \
+		while (running()) {                         \
+			body;                               \
+			++ops;                              \
+		}                                           \
+		w->ops = ops;                               \
+		return NULL;                                \
+	}
+
+WORKER(run_spin, {
+	pthread_spin_lock(&spin);
+	a = a + 1;
+	pthread_spin_unlock(&spin);
+})
+
+WORKER(run_xchg, {
+	xchg_spin_lock(&xchg_lock_var);
+	a = a + 1;
+	xchg_spin_unlock(&xchg_lock_var);
+})
+
+WORKER(run_ttas, {
+	ttas_spin_lock(&ttas_lock_var);
+	a = a + 1;
+	spin_unlock_store(&ttas_lock_var);
+})
+
+WORKER(run_atomic, { __atomic_fetch_add(&a, 1, __ATOMIC_RELAXED); })
+
+// one writer per shard, readers sum all shards
+WORKER(run_sharded, {
+	__atomic_store_n(&shards[w->id].v, shards[w->id].v + 1,
+			 __ATOMIC_RELAXED);
+})
+
+WORKER(run_mutex, {
+	pthread_mutex_lock(&mutex);
+	a = a + 1;
+	pthread_mutex_unlock(&mutex);
+})
+
+WORKER(run_ticket, {
+	ticket_acquire(&ticket);
+	a = a + 1;
+	ticket_release(&ticket);
+})
+
+static const struct {
+	const char *name;
+	void *(*run)(void *);
+	bool sharded;
+} primitives[] = {
+	{ "pthread_spin", run_spin, false },
+	{ "xchg", run_xchg, false },
+	{ "ttas_backoff", run_ttas, false },
+	{ "atomic_add", run_atomic, false },
+	{ "sharded", run_sharded, true },
+	{ "mutex", run_mutex, false },
+	{ "ticket", run_ticket, false },
+};
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(int p, int n, int ms)
+{
+	struct worker *w = aligned_alloc(CACHE_LINE, n * sizeof(struct worker));
+	long total = 0, counted, min = -1, max = 0;
+	double sum_sq = 0;
+
+	a = 0;
+	stop = false;
+	memset(shards, 0, sizeof(shards));
+	pthread_barrier_init(&start, NULL, n + 1);
+	for (int i = 0; i < n; ++i) {
+		cpu_set_t set;
+		w[i].id = i;
+		w[i].ops = 0;
+		pthread_create(&w[i].tid, NULL, primitives[p].run, &w[i]);
+		CPU_ZERO(&set);
+		CPU_SET(i % ncpus, &set);
+		pthread_setaffinity_np(w[i].tid, sizeof(set), &set);
+	}
+	pthread_barrier_wait(&start);
+	double t0 = now();
+	usleep(ms * 1000);
+	__atomic_store_n(&stop, true, __ATOMIC_RELAXED);
+	for (int i = 0; i < n; ++i)
+		pthread_join(w[i].tid, NULL);
+	double elapsed = now() - t0;
+	pthread_barrier_destroy(&start);
+
+	for (int i = 0; i < n; ++i) {
+		total += w[i].ops;
+		sum_sq += (double)w[i].ops * w[i].ops;
+		if (min < 0 || w[i].ops < min)
+			min = w[i].ops;
+		if (w[i].ops > max)
+			max = w[i].ops;
+	}
+	counted = a;
+	if (primitives[p].sharded) {
+		counted = 0;
+		for (int i = 0; i < n; ++i)
+			counted += shards[i].v;
+	}
+
+	printf("%-13s %7d %12.2f %8.3f %8.3f%s\n", primitives[p].name, n,
+	       total / elapsed / 1e6,
+	       sum_sq > 0 ? (double)total * total / (n * sum_sq) : 0,
+	       max > 0 ? (double)min / max : 0,
+	       counted == total ? "" : "  LOST UPDATES");
+	free(w);
+}
+
+int main(int argc, char *argv[])
+{
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	nthreads = argc > 1 ? atoi(argv[1]) : ncpus;
+	int ms = argc > 2 ? atoi(argv[2]) : 200;
+	if (nthreads < 1 || nthreads > MAX_THREADS) {
+		fprintf(stderr, "max_threads must be 1..%d\n", MAX_THREADS);
+		return 1;
+	}
+
+	pthread_spin_init(&spin, 0);
+	printf("%-13s %7s %12s %8s %8s\n", "primitive", "threads", "Mops/s",
+	       "jain", "min/max");
+	for (int p = 0; p < sizeof(primitives) / sizeof(primitives[0]); ++p)
+		for (int n = 1; n <= nthreads; ++n)
+			run(p, n, ms);
+	pthread_spin_destroy(&spin);
+	return 0;
+}
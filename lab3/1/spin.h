@@ -0,0 +1,77 @@
+#ifndef SPIN_H
+#define SPIN_H
+
+/*
+ * Spin locks on an int holding UNLOCK (1) when free and LOCK (0) when
+ * taken, the convention of 1_2.c. The asm only uses local numeric
+ * labels, so the functions can be inlined any number of times.
+ */
+
+#define SPIN_BACKOFF_MIN 4 // pause iterations after the first miss
+#define SPIN_BACKOFF_MAX 1024
+
+/* The original lock: an xchg, a locked RMW, on every attempt */
+static inline void xchg_spin_lock(volatile int *lock)
+{
+	asm volatile("1:\n\t"
+		     "mov $0, %%eax\n\t"
+		     "xchg %%eax, %[lock]\n\t"
+		     "sub $1, %%eax\n\t"
+		     "js 1b\n\t"
+		     : [lock] "+m"(*lock)
+		     :
+		     : "eax", "memory", "cc");
+}
+
+/*
+ * Test-and-test-and-set: after a failed xchg, back off for an
+ * exponentially growing number of pauses, then wait on plain loads
+ * (the line stays shared in every waiter's cache) until the lock looks
+ * free before trying the xchg again
+ */
+static inline void ttas_spin_lock(volatile int *lock)
+{
+	unsigned int backoff = SPIN_BACKOFF_MIN;
+
+	asm volatile("1:\n\t"
+		     "mov $0, %%eax\n\t"
+		     "xchg %%eax, %[lock]\n\t"
+		     "test %%eax, %%eax\n\t"
+		     "jnz 4f\n\t"
+		     // back off, then double the delay up to the cap
+		     "mov %[backoff], %%ecx\n\t"
+		     "2:\n\t"
+		     "pause\n\t"
+		     "dec %%ecx\n\t"
+		     "jnz 2b\n\t"
+		     "shl $1, %[backoff]\n\t"
+		     "cmp %[max], %[backoff]\n\t"
+		     "cmova %[max], %[backoff]\n\t"
+		     // test until the lock is released
+		     "3:\n\t"
+		     "cmpl $1, %[lock]\n\t"
+		     "je 1b\n\t"
+		     "pause\n\t"
+		     "jmp 3b\n\t"
+		     "4:\n\t"
+		     : [lock] "+m"(*lock), [backoff] "+r"(backoff)
+		     : [max] "r"(SPIN_BACKOFF_MAX)
+		     : "eax", "ecx", "memory", "cc");
+}
+
+/* x86 stores are release stores, no locked instruction is needed */
+static inline void spin_unlock_store(volatile int *lock)
+{
+	asm volatile("movl $1, %[lock]\n\t" : [lock] "=m"(*lock) : : "memory");
+}
+
+static inline void xchg_spin_unlock(volatile int *lock)
+{
+	asm volatile("mov $1, %%eax\n\t"
+		     "xchg %%eax, %[lock]\n\t"
+		     : [lock] "+m"(*lock)
+		     :
+		     : "eax", "memory");
+}
+
+#endif
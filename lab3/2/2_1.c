@@ -4,60 +4,36 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/syscall.h>
+#include "../lib/matrix_io.h"
 
-#define matrix_row_x 1234
-#define matrix_col_x 250
-
-#define matrix_row_y 250
-#define matrix_col_y 4
-
-FILE *fptr1;
-FILE *fptr2;
-FILE *fptr3;
-int **x;
-int **y;
+struct matrix x, y, z;
+struct matrix yt; // y transposed, column j of y is row j
 
 // Put file data intp x array
-void data_processing(void)
+int data_processing(void)
 {
-	int tmp;
-	fscanf(fptr1, "%d", &tmp);
-	fscanf(fptr1, "%d", &tmp);
-	for (int i = 0; i < matrix_row_x; i++) {
-		for (int j = 0; j < matrix_col_x; j++) {
-			if (fscanf(fptr1, "%d", &x[i][j]) != 1) {
-				printf("Error reading from file");
-				return;
-			}
-		}
-	}
-
-	fscanf(fptr2, "%d", &tmp);
-	fscanf(fptr2, "%d", &tmp);
-	for (int i = 0; i < matrix_row_y; i++) {
-		for (int j = 0; j < matrix_col_y; j++) {
-			if (fscanf(fptr2, "%d", &y[i][j]) != 1) {
-				printf("Error reading from file");
-				return;
-			}
-		}
+	// the sizes come from the files' headers
+	if (mat_load_factors(&x, "m1.txt", &y, "m2.txt") < 0) {
+		printf("Error reading from file");
+		return -1;
 	}
+	return 0;
 }
 
 void *thread(void *arg)
 {
 	int res;
-	for (int i = 0; i < matrix_row_x; i++) {
-		for (int j = 0; j < matrix_col_y; j++) {
+	for (int i = 0; i < x.rows; i++) {
+		const int *xi = mat_row(&x, i);
+		for (int j = 0; j < y.cols; j++) {
+			const int *yj = mat_row(&yt, j);
 			res = 0;
-			for (int k = 0; k < matrix_row_y; k++) {
+			for (int k = 0; k < y.rows; k++) {
 				/*YOUR CODE HERE*/
-				res += x[i][k] * y[k][j];
+				res += xi[k] * yj[k];
 				/****************/
 			}
-			fprintf(fptr3, "%d ", res);
-			if (j == matrix_col_y - 1)
-				fprintf(fptr3, "\n");
+			MAT(&z, i, j) = res;
 		}
 	}
 	return NULL;
@@ -65,25 +41,22 @@ void *thread(void *arg)
 
 int main()
 {
-	x = malloc(sizeof(int *) * matrix_row_x);
-	for (int i = 0; i < matrix_row_x; i++) {
-		x[i] = malloc(sizeof(int) * matrix_col_x);
-	}
-	y = malloc(sizeof(int *) * matrix_row_y);
-	for (int i = 0; i < matrix_row_y; i++) {
-		y[i] = malloc(sizeof(int) * matrix_col_y);
-	}
-	fptr1 = fopen("m1.txt", "r");
-	fptr2 = fopen("m2.txt", "r");
-	fptr3 = fopen("2.txt", "a");
 	pthread_t t1;
-	data_processing();
-	fprintf(fptr3, "%d %d\n", matrix_row_x, matrix_col_y);
+	if (data_processing() < 0)
+		return 1;
+	if (mat_transpose(&yt, &y) < 0 ||
+	    mat_alloc(&z, x.rows, y.cols) < 0) {
+		printf("Out of memory");
+		return 1;
+	}
 
 	pthread_create(&t1, NULL, thread, NULL);
 	pthread_join(t1, NULL);
 
-	fclose(fptr1);
-	fclose(fptr2);
-	fclose(fptr3);
+	int ret = mat_append_text(&z, "2.txt", pool_default_threads());
+	mat_free(&x);
+	mat_free(&y);
+	mat_free(&yt);
+	mat_free(&z);
+	return ret < 0 ? 1 : 0;
 }
@@ -3,60 +3,51 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include "../lib/matrix_io.h"
 
-#define matrix_row_x 1234
-#define matrix_col_x 250
-
-#define matrix_row_y 250
-#define matrix_col_y 4
-
-pthread_spinlock_t lock;
-FILE *fptr1;
-FILE *fptr2;
-FILE *fptr3;
-int **x;
-int **y;
-int **z;
+struct matrix x, y, z;
+struct matrix yt; // y transposed, column j of y is row j
 
 // Put file data intp x array
-void data_processing(void)
+int data_processing(void)
 {
-	int tmp;
-	fscanf(fptr1, "%d", &tmp);
-	fscanf(fptr1, "%d", &tmp);
-	for (int i = 0; i < matrix_row_x; i++) {
-		for (int j = 0; j < matrix_col_x; j++) {
-			if (fscanf(fptr1, "%d", &x[i][j]) != 1) {
-				printf("Error reading from file");
-				return;
-			}
-		}
+	// the sizes come from the files' headers
+	if (mat_load_factors(&x, "m1.txt", &y, "m2.txt") < 0) {
+		printf("Error reading from file");
+		return -1;
 	}
+	return 0;
+}
 
-	fscanf(fptr2, "%d", &tmp);
-	fscanf(fptr2, "%d", &tmp);
-	for (int i = 0; i < matrix_row_y; i++) {
-		for (int j = 0; j < matrix_col_y; j++) {
-			if (fscanf(fptr2, "%d", &y[i][j]) != 1) {
-				printf("Error reading from file");
-				return;
-			}
-		}
+/*
+ * Split-k: z = x[:, 0:n/2] * y[0:n/2, :] + x[:, n/2:n] * y[n/2:n, :].
+ * Each thread sums its k range in a register into a private partial z,
+ * then adds the partial into z once, one atomic add per element.
+ */
+void split_k(int k0, int k1)
+{
+	struct matrix part;
+	if (mat_alloc(&part, x.rows, y.cols) < 0) {
+		printf("Out of memory");
+		return;
+	}
+	for (int i = 0; i < x.rows; i++) {
+		const int *xi = mat_row(&x, i);
+		for (int j = 0; j < y.cols; j++)
+			MAT(&part, i, j) = mat_dot(xi + k0,
+						   mat_row(&yt, j) + k0, k1 - k0);
 	}
+	for (int i = 0; i < x.rows; i++)
+		for (int j = 0; j < y.cols; j++)
+			__atomic_fetch_add(&MAT(&z, i, j), MAT(&part, i, j),
+					   __ATOMIC_RELAXED);
+	mat_free(&part);
 }
 
 void *thread1(void *arg)
 {
 	/*YOUR CODE HERE*/
-	for (int i = 0; i < matrix_row_x; i++) {
-		for (int j = 0; j < matrix_col_y; j++) {
-			for (int k = 0; k < matrix_row_y / 2; k++) {
-				pthread_spin_lock(&lock);
-				z[i][j] += x[i][k] * y[k][j];
-				pthread_spin_unlock(&lock);
-			}
-		}
-	}
+	split_k(0, y.rows / 2);
 	/****************/
 	return NULL;
 }
@@ -64,56 +55,31 @@ void *thread1(void *arg)
 void *thread2(void *arg)
 {
 	/*YOUR CODE HERE*/
-	for (int i = 0; i < matrix_row_x; i++) {
-		for (int j = 0; j < matrix_col_y; j++) {
-			for (int k = matrix_row_y / 2; k < matrix_row_y; k++) {
-				pthread_spin_lock(&lock);
-				z[i][j] += x[i][k] * y[k][j];
-				pthread_spin_unlock(&lock);
-			}
-		}
-	}
+	split_k(y.rows / 2, y.rows);
 	/****************/
 	return NULL;
 }
 
 int main()
 {
-	x = malloc(sizeof(int *) * matrix_row_x);
-	for (int i = 0; i < matrix_row_x; i++) {
-		x[i] = malloc(sizeof(int) * matrix_col_x);
-	}
-	y = malloc(sizeof(int *) * matrix_row_y);
-	for (int i = 0; i < matrix_row_y; i++) {
-		y[i] = malloc(sizeof(int) * matrix_col_y);
-	}
-	z = malloc(sizeof(int *) * matrix_row_x);
-	for (int i = 0; i < matrix_row_x; i++) {
-		z[i] = malloc(sizeof(int) * matrix_col_y);
-	}
-	fptr1 = fopen("m1.txt", "r");
-	fptr2 = fopen("m2.txt", "r");
-	fptr3 = fopen("2.txt", "a");
 	pthread_t t1, t2;
-	data_processing();
-	fprintf(fptr3, "%d %d\n", matrix_row_x, matrix_col_y);
+	if (data_processing() < 0)
+		return 1;
+	if (mat_alloc(&z, x.rows, y.cols) < 0 || mat_transpose(&yt, &y) < 0) {
+		printf("Out of memory");
+		return 1;
+	}
 
-	pthread_spin_init(&lock, 0);
 	pthread_create(&t1, NULL, thread1, NULL);
 	pthread_create(&t2, NULL, thread2, NULL);
 	pthread_join(t1, NULL);
 	pthread_join(t2, NULL);
-	pthread_spin_destroy(&lock);
 
 	//Write output matrix into file.
-	for (int i = 0; i < matrix_row_x; i++) {
-		for (int j = 0; j < matrix_col_y; j++) {
-			fprintf(fptr3, "%d ", z[i][j]);
-			if (j == matrix_col_y - 1)
-				fprintf(fptr3, "\n");
-		}
-	}
-	fclose(fptr1);
-	fclose(fptr2);
-	fclose(fptr3);
+	int ret = mat_append_text(&z, "2.txt", pool_default_threads());
+	mat_free(&x);
+	mat_free(&y);
+	mat_free(&yt);
+	mat_free(&z);
+	return ret < 0 ? 1 : 0;
 }
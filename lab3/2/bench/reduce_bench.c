@@ -0,0 +1,179 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../../lib/matrix.h"
+
+/*
+ * Split-k reduction benchmark
+ *
+ * z = x * y with the 1234x250 by 250x4 shapes of 2_2.c, k split into
+ * one contiguous range per thread, every thread adding into all of z:
+ *   locked   a spin lock around every z[i][j] += x[i][k] * y[k][j],
+ *            the original 2_2.c
+ *   atomic   an atomic add for every k instead of the lock
+ *   split_k  a register sum into a private partial z, merged into z
+ *            with one atomic add per element, what 2_2.c does now
+ * Each run is checked against a single-threaded product; the time is
+ * the best of the runs and "speedup" is against locked at the same
+ * thread count.
+ *
+ * usage: reduce_bench [max_threads] [runs]
+ */
+
+#define ROWS 1234
+#define DEPTH 250
+#define COLS 4
+
+struct worker {
+	pthread_t tid;
+	int k0, k1;
+};
+
+static struct matrix x, y, yt, z, want;
+static pthread_spinlock_t lock;
+static int ncpus;
+
+static void *run_locked(void *arg)
+{
+	struct worker *w = (struct worker *)arg;
+	for (int i = 0; i < ROWS; i++)
+		for (int j = 0; j < COLS; j++)
+			for (int k = w->k0; k < w->k1; k++) {
+				pthread_spin_lock(&lock);
+				MAT(&z, i, j) += MAT(&x, i, k) * MAT(&y, k, j);
+				pthread_spin_unlock(&lock);
+			}
+	return NULL;
+}
+
+static void *run_atomic(void *arg)
+{
+	struct worker *w = (struct worker *)arg;
+	for (int i = 0; i < ROWS; i++)
+		for (int j = 0; j < COLS; j++)
+			for (int k = w->k0; k < w->k1; k++)
+				__atomic_fetch_add(&MAT(&z, i, j),
+						   MAT(&x, i, k) * MAT(&y, k, j),
+						   __ATOMIC_RELAXED);
+	return NULL;
+}
+
+static void *run_split_k(void *arg)
+{
+	struct worker *w = (struct worker *)arg;
+	struct matrix part;
+	mat_alloc(&part, ROWS, COLS);
+	for (int i = 0; i < ROWS; i++) {
+		const int *xi = mat_row(&x, i) + w->k0;
+		for (int j = 0; j < COLS; j++)
+			MAT(&part, i, j) = mat_dot(xi, mat_row(&yt, j) + w->k0,
+						   w->k1 - w->k0);
+	}
+	for (int i = 0; i < ROWS; i++)
+		for (int j = 0; j < COLS; j++)
+			__atomic_fetch_add(&MAT(&z, i, j), MAT(&part, i, j),
+					   __ATOMIC_RELAXED);
+	mat_free(&part);
+	return NULL;
+}
+
+static const struct {
+	const char *name;
+	void *(*run)(void *);
+} variants[] = {
+	{ "locked", run_locked },
+	{ "atomic", run_atomic },
+	{ "split_k", run_split_k },
+};
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// best time of runs, -1 if a result is wrong
+static double run(int v, int n, int runs)
+{
+	struct worker w[n];
+	double best = 1e30;
+
+	for (int r = 0; r < runs; r++) {
+		memset(z.data, 0, (size_t)z.rows * z.stride * sizeof(int));
+		double t = now();
+		for (int i = 0; i < n; i++) {
+			cpu_set_t set;
+			w[i].k0 = DEPTH * i / n;
+			w[i].k1 = DEPTH * (i + 1) / n;
+			pthread_create(&w[i].tid, NULL, variants[v].run, &w[i]);
+			CPU_ZERO(&set);
+			CPU_SET(i % ncpus, &set);
+			pthread_setaffinity_np(w[i].tid, sizeof(set), &set);
+		}
+		for (int i = 0; i < n; i++)
+			pthread_join(w[i].tid, NULL);
+		t = now() - t;
+		best = t < best ? t : best;
+		for (int i = 0; i < ROWS; i++)
+			if (memcmp(mat_row(&z, i), mat_row(&want, i),
+				   COLS * sizeof(int)))
+				return -1;
+	}
+	return best;
+}
+
+int main(int argc, char *argv[])
+{
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int max_threads = argc > 1 ? atoi(argv[1]) : ncpus;
+	int runs = argc > 2 ? atoi(argv[2]) : 5;
+	int nvariants = sizeof(variants) / sizeof(variants[0]);
+	if (max_threads < 1 || runs < 1) {
+		fprintf(stderr, "usage: %s [max_threads] [runs]\n", argv[0]);
+		return 1;
+	}
+
+	if (mat_alloc(&x, ROWS, DEPTH) < 0 || mat_alloc(&y, DEPTH, COLS) < 0 ||
+	    mat_alloc(&z, ROWS, COLS) < 0 || mat_alloc(&want, ROWS, COLS) < 0) {
+		printf("Out of memory\n");
+		return 1;
+	}
+	srand(1);
+	for (int i = 0; i < ROWS; i++)
+		for (int k = 0; k < DEPTH; k++)
+			MAT(&x, i, k) = rand() % 1000;
+	for (int k = 0; k < DEPTH; k++)
+		for (int j = 0; j < COLS; j++)
+			MAT(&y, k, j) = rand() % 1000;
+	mat_transpose(&yt, &y);
+	for (int i = 0; i < ROWS; i++)
+		for (int j = 0; j < COLS; j++)
+			for (int k = 0; k < DEPTH; k++)
+				MAT(&want, i, j) += MAT(&x, i, k) * MAT(&y, k, j);
+
+	pthread_spin_init(&lock, 0);
+	printf("%-9s %7s %10s %8s\n", "variant", "threads", "ms", "speedup");
+	for (int n = 1; n <= max_threads; n++) {
+		double locked = 0;
+		for (int v = 0; v < nvariants; v++) {
+			double t = run(v, n, runs);
+			if (t < 0) {
+				printf("%-9s %7d WRONG RESULT\n", variants[v].name,
+				       n);
+				continue;
+			}
+			if (v == 0)
+				locked = t;
+			printf("%-9s %7d %10.3f %8.1f\n", variants[v].name, n,
+			       t * 1e3, locked / t);
+		}
+	}
+	pthread_spin_destroy(&lock);
+	return 0;
+}
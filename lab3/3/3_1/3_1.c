@@ -5,109 +5,62 @@
 #include <string.h>
 #include <fcntl.h>
 #include <stdbool.h>
+#include "../../lib/gemm.h"
+#include "../../lib/matrix_io.h"
+#include "../../lib/thread_stats.h"
 
-#define matrix_row_x 1234
-#define matrix_col_x 250
-
-#define matrix_row_y 250
-#define matrix_col_y 4
-
-FILE *fptr1;
-FILE *fptr2;
-FILE *fptr3;
-FILE *fptr4;
-FILE *fptr5;
-int **x;
-int **y;
-int **z;
+struct matrix x, y, z;
+// the workers stay alive until main has read their stats
+pthread_barrier_t computed, release;
 
 // Put file data intp x array
-void data_processing(void){
-    int tmp;
-    fscanf(fptr1, "%d", &tmp);
-    fscanf(fptr1, "%d", &tmp);
-    for(int i=0; i<matrix_row_x; i++){
-        for(int j=0; j<matrix_col_x; j++){
-            if (fscanf(fptr1, "%d", &x[i][j])!=1){
-                printf("Error reading from file");
-                return;
-            }
-        }
+int data_processing(void){
+    // the sizes come from the files' headers
+    if (mat_load_factors(&x, "m1.txt", &y, "m2.txt") < 0){
+        printf("Error reading from file");
+        return -1;
     }
-
-    fscanf(fptr2, "%d", &tmp);
-    fscanf(fptr2, "%d", &tmp);
-     for(int i=0; i<matrix_row_y; i++){
-        for(int j=0; j<matrix_col_y; j++){
-            if (fscanf(fptr2, "%d", &y[i][j])!=1){
-                printf("Error reading from file");
-                return;
-            }
-        }
-    }   
+    return 0;
 }
 
 void *thread1(void *arg){
-    for(int i=0; i<matrix_row_x/2; i++){
-        for(int j=0; j<matrix_col_y; j++){
-            for(int k=0; k<matrix_row_y; k++){
-                z[i][j] += x[i][k] * y[k][j];
-            }      
-        }
-    }
+    if (gemm_rows(&z, &x, &y, 0, x.rows/2) < 0)
+        printf("Out of memory");
+    pthread_barrier_wait(&computed);
+    pthread_barrier_wait(&release);
+    return NULL;
 }
 
 void *thread2(void *arg){
-    for(int i=matrix_row_x/2; i<matrix_row_x; i++){
-        for(int j=0; j<matrix_col_y; j++){
-            for(int k=0; k<matrix_row_y; k++){
-                z[i][j] += x[i][k] * y[k][j];
-            }     
-        }
-    } 
+    if (gemm_rows(&z, &x, &y, x.rows/2, x.rows) < 0)
+        printf("Out of memory");
+    pthread_barrier_wait(&computed);
+    pthread_barrier_wait(&release);
+    return NULL;
 }
 
 int main(){
-    ssize_t bytesRead;
-    char buffer[50];
-    x = malloc(sizeof(int*)*matrix_row_x);
-    for(int i=0; i<matrix_row_x; i++){
-        x[i] = malloc(sizeof(int)*matrix_col_x);
-    }
-    y = malloc(sizeof(int*)*matrix_row_y);
-    for(int i=0; i<matrix_row_y; i++){
-        y[i] = malloc(sizeof(int)*matrix_col_y);
-    }
-    z = malloc(sizeof(int*)*matrix_row_x);
-    for(int i=0; i<matrix_row_x; i++){
-        z[i] = malloc(sizeof(int)*matrix_col_y);
-    }
-    fptr1 = fopen("m1.txt", "r");
-    fptr2 = fopen("m2.txt", "r");
-    fptr3 = fopen("3_1.txt", "a");
-    fptr4 = fopen("/proc/Mythread_info", "r");
-    fptr5 = fopen("/proc/Mythread_info", "r");
-
     pthread_t t1, t2;
-    data_processing();
-    fprintf(fptr3, "%d %d\n", matrix_row_x, matrix_col_y);
+    if (data_processing() < 0)
+        return 1;
+    if (mat_alloc(&z, x.rows, y.cols) < 0){
+        printf("Out of memory");
+        return 1;
+    }
 
+    gemm_select();
+    pthread_barrier_init(&computed, NULL, 3);
+    pthread_barrier_init(&release, NULL, 3);
     pthread_create(&t1, NULL, thread1, NULL);
     pthread_create(&t2, NULL, thread2, NULL);
-    while (fgets(buffer, sizeof(buffer), fptr4) != NULL){
-        printf("%s", buffer);
-    }
+    pthread_barrier_wait(&computed);
+    if (thread_stats_table(stdout, "/proc/Mythread_info") < 0)
+        printf("/proc/Mythread_info: not loaded\n");
+    pthread_barrier_wait(&release);
     pthread_join(t1, NULL);
     pthread_join(t2, NULL);
-    for(int i=0; i<matrix_row_x; i++){
-        for(int j=0; j<matrix_col_y; j++){
-            fprintf(fptr3, "%d ", z[i][j]);
-            if(j==matrix_col_y-1) fprintf(fptr3, "\n");   
-        }
-    }
-    fclose(fptr1);
-    fclose(fptr2);
-    fclose(fptr3);
-    fclose(fptr4);
-    fclose(fptr5);
+    pthread_barrier_destroy(&computed);
+    pthread_barrier_destroy(&release);
+    if (mat_append_text(&z, "3_1.txt", 2) < 0)
+        return 1;
 }
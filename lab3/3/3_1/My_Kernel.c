@@ -3,11 +3,15 @@
 #include <linux/init.h>
 #include <linux/printk.h>
 #include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/sched.h>
+#include <linux/sched/signal.h>
+#include <linux/math64.h>
 #include <asm/current.h>
 
 #define procfs_name "Mythread_info"
-#define BUFSIZE 1024
-char buf[BUFSIZE];
+
+static struct proc_dir_entry *proc_entry;
 
 static ssize_t Mywrite(struct file *fileptr, const char __user *ubuf,
 		       size_t buffer_len, loff_t *offset)
@@ -16,48 +20,72 @@ static ssize_t Mywrite(struct file *fileptr, const char __user *ubuf,
 	return 0;
 }
 
-static ssize_t Myread(struct file *fileptr, char __user *ubuf,
-		      size_t buffer_len, loff_t *offset)
+/*
+ * One line per thread of the reader's process, other than the reader:
+ * the CPU it last ran on, how often it moved between CPUs and what it
+ * cost. Times are in microseconds; wait is the time spent runnable on a
+ * runqueue and runs the number of times it got a CPU (both 0 without
+ * CONFIG_SCHED_INFO). seq_file grows the buffer as needed, so any
+ * number of threads fits.
+ */
+static int Myshow(struct seq_file *m, void *v)
 {
 	/*Your code here*/
-	if (*offset > 0) {
-		return 0; // EOF
-	}
-
 	struct task_struct *thread;
+	unsigned long long wait = 0;
+	unsigned long runs = 0;
+
+	rcu_read_lock();
 	for_each_thread(current, thread) {
 		if (current->pid == thread->pid) {
 			continue;
 		}
-		int len = sprintf(&buf[*offset],
-				  "PID: %d, TID: %d, Priority: %d, State: %d\n",
-				  current->pid, thread->pid, thread->prio,
-				  thread->__state);
-		*offset += len;
+#ifdef CONFIG_SCHED_INFO
+		wait = div_u64(thread->sched_info.run_delay, NSEC_PER_USEC);
+		runs = thread->sched_info.pcount;
+#endif
+		seq_printf(m,
+			   "PID: %d, TID: %d, Priority: %d, State: %d, "
+			   "CPU: %d, migrations: %llu, utime: %llu, "
+			   "stime: %llu, nvcsw: %lu, nivcsw: %lu, wait: %llu, "
+			   "runs: %lu\n",
+			   current->pid, thread->pid, thread->prio,
+			   READ_ONCE(thread->__state), task_cpu(thread),
+			   thread->se.nr_migrations,
+			   div_u64(thread->utime, NSEC_PER_USEC),
+			   div_u64(thread->stime, NSEC_PER_USEC),
+			   thread->nvcsw, thread->nivcsw, wait, runs);
 	}
-
-	int fail = copy_to_user(ubuf, buf, *offset);
-	if (fail)
-		return -EFAULT;
-
-	return *offset;
+	rcu_read_unlock();
+	return 0;
 	/****************/
 }
 
+static int Myopen(struct inode *inode, struct file *fileptr)
+{
+	return single_open(fileptr, Myshow, NULL);
+}
+
 static struct proc_ops Myops = {
-	.proc_read = Myread,
+	.proc_open = Myopen,
+	.proc_read = seq_read,
+	.proc_lseek = seq_lseek,
+	.proc_release = single_release,
 	.proc_write = Mywrite,
 };
 
 static int My_Kernel_Init(void)
 {
-	proc_create(procfs_name, 0644, NULL, &Myops);
+	proc_entry = proc_create(procfs_name, 0644, NULL, &Myops);
+	if (!proc_entry)
+		return -ENOMEM;
 	pr_info("My kernel says Hi");
 	return 0;
 }
 
 static void My_Kernel_Exit(void)
 {
+	proc_remove(proc_entry);
 	pr_info("My kernel says GOODBYE");
 }
 
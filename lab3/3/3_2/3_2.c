@@ -5,207 +5,132 @@
 #include <string.h>
 #include <fcntl.h>
 #include <stdbool.h>
-#include "3_2_Config.h"
+#include "../../lib/gemm.h"
+#include "../../lib/strassen.h"
+#include "../../lib/pool.h"
+#include "../../lib/matrix_io.h"
 
-#define matrix_row_x 1234
-#define matrix_col_x 250
+// z is computed in tiles; columns in multiples of GEMM_NR for gemm_tile()
+#define TILE_ROWS GEMM_MC
+#define TILE_COLS (16 * GEMM_NR)
+#define tile_grid_cols ((y.cols + TILE_COLS - 1) / TILE_COLS)
 
-#define matrix_row_y 250
-#define matrix_col_y 1234
-
-FILE *fptr1;
-FILE *fptr2;
-FILE *fptr3;
-FILE *fptr4;
-FILE *fptr5;
-int **x;
-int **y;
-int **z;
+struct matrix x, y, z;
 pid_t tid1, tid2;
 
-pthread_spinlock_t lock;
+// -e: a progress marker per tile in the module's event log
+bool events;
+__thread int events_fd = -1;
 
 // Put file data intp x array
-void data_processing(void)
+int data_processing(void)
 {
-	int tmp;
-	fscanf(fptr1, "%d", &tmp);
-	fscanf(fptr1, "%d", &tmp);
-	for (int i = 0; i < matrix_row_x; i++) {
-		for (int j = 0; j < matrix_col_x; j++) {
-			if (fscanf(fptr1, "%d", &x[i][j]) != 1) {
-				printf("Error reading from file");
-				return;
-			}
-		}
-	}
-
-	fscanf(fptr2, "%d", &tmp);
-	fscanf(fptr2, "%d", &tmp);
-	for (int i = 0; i < matrix_row_y; i++) {
-		for (int j = 0; j < matrix_col_y; j++) {
-			if (fscanf(fptr2, "%d", &y[i][j]) != 1) {
-				printf("Error reading from file");
-				return;
-			}
-		}
+	// the sizes come from the files' headers
+	if (mat_load_factors(&x, "m1.txt", &y, "m2.txt") < 0) {
+		printf("Error reading from file");
+		return -1;
 	}
+	return 0;
 }
 
-void *thread1(void *arg)
+// one tile of z, numbered row-major over the grid of tiles
+void tile(void *arg, int task, int worker)
 {
-	char data[30];
-	sprintf(data, "%s", "Thread 1 says hello!\n");
-
-#if (THREAD_NUMBER == 1)
-	for (int i = 0; i < matrix_row_x; i++) {
-		for (int j = 0; j < matrix_col_y; j++) {
-			for (int k = 0; k < matrix_row_y; k++) {
-				z[i][j] += x[i][k] * y[k][j];
-			}
-		}
-	}
-#elif (THREAD_NUMBER == 2)
-	for (int i = 0; i < matrix_row_x / 2; i++) {
-		for (int j = 0; j < matrix_col_y; j++) {
-			for (int k = 0; k < matrix_row_y; k++) {
-				z[i][j] += x[i][k] * y[k][j];
-			}
-		}
-	}
-#endif
-
-	/*YOUR CODE HERE*/
-	/* Hint: Write data into proc file.*/
-	static bool lock_initialized;
-	bool locked = false;
-
-	if (!lock_initialized &&
-	    pthread_spin_init(&lock, PTHREAD_PROCESS_PRIVATE) == 0)
-		lock_initialized = true;
-
-	if (lock_initialized && pthread_spin_lock(&lock) == 0)
-		locked = true;
-
-	FILE *fd = NULL;
-	if (locked)
-		fd = fopen("/proc/Mythread_info", "w");
-
-	if (fd != NULL) {
-		fwrite(data, sizeof(char), strlen(data), fd);
-		fclose(fd);
-	}
-
-	char buffer[50];
-	if (locked && fptr4 != NULL)
-		rewind(fptr4);
-	while (locked && fptr4 != NULL &&
-	       fgets(buffer, sizeof(buffer), fptr4) != NULL) {
-		printf("%s", buffer);
+	int r0 = task / tile_grid_cols * TILE_ROWS;
+	int c0 = task % tile_grid_cols * TILE_COLS;
+	int r1 = r0 + TILE_ROWS < x.rows ? r0 + TILE_ROWS : x.rows;
+	int c1 = c0 + TILE_COLS < y.cols ? c0 + TILE_COLS : y.cols;
+
+	if (gemm_tile(&z, &x, &y, r0, r1, c0, c1) < 0)
+		printf("Out of memory");
+
+	if (events) {
+		char marker[32];
+		if (events_fd < 0)
+			events_fd = open("/proc/Mythread_events", O_WRONLY);
+		if (events_fd >= 0 &&
+		    write(events_fd, marker,
+			  sprintf(marker, "tile %d done", task)) < 0)
+			perror("/proc/Mythread_events");
 	}
-
-	if (locked)
-		pthread_spin_unlock(&lock);
-
-#if (THREAD_NUMBER == 1)
-	exit(0);
-#endif
-
-	return NULL;
 }
 
-#if (THREAD_NUMBER == 2)
-void *thread2(void *arg)
+// every worker says hello through the proc file after its last tile
+void hello(void *arg, int worker)
 {
-	char data[30];
-	sprintf(data, "%s", "Thread 2 says hello!\n");
-	for (int i = matrix_row_x / 2; i < matrix_row_x; i++) {
-		for (int j = 0; j < matrix_col_y; j++) {
-			for (int k = 0; k < matrix_row_y; k++) {
-				z[i][j] += x[i][k] * y[k][j];
-			}
-		}
+	char data[40];
+	sprintf(data, "Thread %d says hello!\n", worker + 1);
+	if (events_fd >= 0) {
+		close(events_fd);
+		events_fd = -1;
 	}
 
 	/*YOUR CODE HERE*/
 	/* Hint: Write data into proc file.*/
-	static bool lock_initialized;
-	bool locked = false;
-
-	if (!lock_initialized &&
-	    pthread_spin_init(&lock, PTHREAD_PROCESS_PRIVATE) == 0)
-		lock_initialized = true;
-
-	if (lock_initialized && pthread_spin_lock(&lock) == 0)
-		locked = true;
-
-	FILE *fd = NULL;
-	if (locked)
-		fd = fopen("/proc/Mythread_info", "w");
-
-	if (fd != NULL) {
-		fwrite(data, sizeof(char), strlen(data), fd);
-		fclose(fd);
-	}
+	// the module keeps what is written per open file: no lock needed
+	FILE *fd = fopen("/proc/Mythread_info", "r+");
+	if (fd == NULL)
+		return;
+	fwrite(data, sizeof(char), strlen(data), fd);
 	/****************/
 
-	char buffer[50];
-	if (locked && fptr5 != NULL)
-		rewind(fptr5);
-	while (locked && fptr5 != NULL &&
-	       fgets(buffer, sizeof(buffer), fptr5) != NULL) {
-		printf("%s", buffer);
-	}
-
-	if (locked)
-		pthread_spin_unlock(&lock);
-
-	return NULL;
+	// read back through the same file; one printf keeps the lines together
+	char buffer[256];
+	size_t len;
+	rewind(fd);
+	len = fread(buffer, sizeof(char), sizeof(buffer) - 1, fd);
+	buffer[len] = '\0';
+	printf("%s", buffer);
+	fclose(fd);
 }
-#endif
 
-int main()
+int main(int argc, char *argv[])
 {
-	char buffer[50];
-	x = malloc(sizeof(int *) * matrix_row_x);
-	for (int i = 0; i < matrix_row_x; i++) {
-		x[i] = malloc(sizeof(int) * matrix_col_x);
+	struct pool pool = { .nthreads = pool_default_threads(),
+			     .task = tile,
+			     .done = hello };
+	struct strassen sw;
+	int opt, cutoff = 0, bad = 0;
+
+	while ((opt = getopt(argc, argv, "j:s:e")) != -1) {
+		if (opt == 'j')
+			bad |= (pool.nthreads = atoi(optarg)) < 1;
+		else if (opt == 's')
+			bad |= (cutoff = atoi(optarg)) < 1;
+		else if (opt == 'e')
+			events = true;
+		else
+			bad = 1;
 	}
-	y = malloc(sizeof(int *) * matrix_row_y);
-	for (int i = 0; i < matrix_row_y; i++) {
-		y[i] = malloc(sizeof(int) * matrix_col_y);
+	if (bad) {
+		fprintf(stderr,
+			"usage: %s [-j threads] [-s strassen cutoff] [-e]\n",
+			argv[0]);
+		return 1;
 	}
-	z = malloc(sizeof(int *) * matrix_row_x);
-	for (int i = 0; i < matrix_row_x; i++) {
-		z[i] = malloc(sizeof(int) * matrix_col_y);
+	if (data_processing() < 0)
+		return 1;
+	if (mat_alloc(&z, x.rows, y.cols) < 0) {
+		printf("Out of memory");
+		return 1;
 	}
-	fptr1 = fopen("m1.txt", "r");
-	fptr2 = fopen("m2.txt", "r");
-	fptr3 = fopen("3_2.txt", "a");
-	fptr4 = fopen("/proc/Mythread_info", "r");
-	fptr5 = fopen("/proc/Mythread_info", "r");
-
-	pthread_t t1, t2;
-	data_processing();
-	fprintf(fptr3, "%d %d\n", matrix_row_x, matrix_col_y);
 
-	pthread_create(&t1, NULL, thread1, NULL);
-#if (THREAD_NUMBER == 2)
-	pthread_create(&t2, NULL, thread2, NULL);
-#endif
-	pthread_join(t1, NULL);
-	pthread_join(t2, NULL);
-
-	for (int i = 0; i < matrix_row_x; i++) {
-		for (int j = 0; j < matrix_col_y; j++) {
-			fprintf(fptr3, "%d ", z[i][j]);
-			if (j == matrix_col_y - 1)
-				fprintf(fptr3, "\n");
-		}
+	gemm_select();
+	int tasks = (x.rows + TILE_ROWS - 1) / TILE_ROWS * tile_grid_cols;
+	// -s: the 7 top level Strassen-Winograd products instead of tiles
+	if (cutoff) {
+		pool.task = strassen_task;
+		pool.arg = &sw;
+		tasks = strassen_init(&sw, &z, &x, &y, cutoff);
+	}
+	if (tasks < 0 || pool_run(&pool, tasks) < 0 ||
+	    (cutoff && strassen_finish(&sw) < 0)) {
+		printf("Out of memory");
+		return 1;
 	}
-	fclose(fptr1);
-	fclose(fptr2);
-	fclose(fptr3);
-	fclose(fptr4);
-	fclose(fptr5);
+	pool_report(stderr, &pool);
+	pool_free(&pool);
+
+	if (mat_append_text(&z, "3_2.txt", pool.nthreads) < 0)
+		return 1;
 }
@@ -3,77 +3,290 @@
 #include <linux/init.h>
 #include <linux/printk.h>
 #include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/llist.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/percpu.h>
+#include <linux/vmalloc.h>
+#include <linux/ktime.h>
 #include <asm/current.h>
-#include <linux/string.h>
+#include "my_event.h"
 
 #define procfs_name "Mythread_info"
-#define BUFSIZE 1024
-char buf[BUFSIZE]; //kernel buffer
-static struct proc_dir_entry *proc_entry;
+#define events_name "Mythread_events"
+#define MAX_RECORD PAGE_SIZE // bytes of one write that are kept
+#define RING_SIZE 4096 // events per CPU, a power of 2
+#define RING_MASK (RING_SIZE - 1)
+
+static struct proc_dir_entry *proc_entry, *events_entry;
+
+/*
+ * What one write() left: the text, then the writer's time. Every open
+ * file has its own records, read back through the same file, so threads
+ * that open the file each on their own never see each other's.
+ */
+struct my_record {
+	struct llist_node node;
+	pid_t tgid, pid;
+	u64 utime;
+	size_t len;
+	char msg[];
+};
+
+struct my_file {
+	struct llist_head pending; // written, newest first; lock-free
+	// already moved out of pending, oldest first; under the seq_file lock
+	struct llist_node *shown, **tail;
+};
 
 static ssize_t Mywrite(struct file *fileptr, const char __user *ubuf,
 		       size_t ubuffer_len, loff_t *offset)
 {
 	/*Your code here*/
-	size_t buffer_len = strnlen(buf, BUFSIZE);
-	size_t space_left;
-	size_t copy_len;
+	struct seq_file *m = fileptr->private_data;
+	struct my_file *f = m->private;
+	size_t len = min_t(size_t, ubuffer_len, MAX_RECORD);
+	struct my_record *rec;
 
-	if (buffer_len >= BUFSIZE)
-		return -ENOSPC;
+	rec = kmalloc(struct_size(rec, msg, len), GFP_KERNEL);
+	if (!rec)
+		return -ENOMEM;
+	if (copy_from_user(rec->msg, ubuf, len)) {
+		kfree(rec);
+		return -EFAULT;
+	}
+	rec->len = len;
+	rec->tgid = current->tgid;
+	rec->pid = current->pid;
+	rec->utime = current->utime;
+	llist_add(&rec->node, &f->pending);
 
-	space_left = BUFSIZE - buffer_len - 1;
-	copy_len = min(ubuffer_len, space_left);
-	if (copy_len == 0)
-		return -ENOSPC;
+	return len;
+	/****************/
+}
 
-	if (copy_from_user(&buf[buffer_len], ubuf, copy_len))
-		return -EFAULT;
-	buffer_len += copy_len;
-	buf[buffer_len] = '\0';
+/*
+ * Everything written through this file so far, in order. Called again
+ * with a bigger buffer when the output does not fit, so nothing is
+ * consumed: the records stay until the file is closed.
+ */
+static int Myshow(struct seq_file *m, void *v)
+{
+	/*Your code here*/
+	struct my_file *f = m->private;
+	struct my_record *rec;
 
-	buffer_len += scnprintf(&buf[buffer_len], BUFSIZE - buffer_len,
-				"PID: %d, TID: %d, Time: %llu\n",
-				current->tgid, current->pid,
-				current->utime / 100 / 1000);
+	*f->tail = llist_reverse_order(llist_del_all(&f->pending));
+	while (*f->tail)
+		f->tail = &(*f->tail)->next;
 
-	return copy_len;
+	llist_for_each_entry(rec, f->shown, node) {
+		seq_write(m, rec->msg, rec->len);
+		seq_printf(m, "PID: %d, TID: %d, Time: %llu\n", rec->tgid,
+			   rec->pid, rec->utime / 100 / 1000);
+	}
+	return 0;
 	/****************/
 }
 
-static ssize_t Myread(struct file *fileptr, char __user *ubuf,
-		      size_t buffer_len, loff_t *offset)
+static int Myopen(struct inode *inode, struct file *fileptr)
 {
-	/*Your code here*/
-	size_t data_len = strnlen(buf, BUFSIZE);
+	struct my_file *f = kzalloc(sizeof(*f), GFP_KERNEL);
+	int ret;
 
-	if (*offset > 0)
-		return 0;
+	if (!f)
+		return -ENOMEM;
+	init_llist_head(&f->pending);
+	f->tail = &f->shown;
+	ret = single_open(fileptr, Myshow, f);
+	if (ret)
+		kfree(f);
+	return ret;
+}
 
-	if (buffer_len < data_len)
-		return -EINVAL;
+static void free_records(struct llist_node *node)
+{
+	struct my_record *rec, *next;
 
-	if (copy_to_user(ubuf, buf, data_len))
-		return -EFAULT;
+	llist_for_each_entry_safe(rec, next, node, node)
+		kfree(rec);
+}
 
-	*offset = data_len;
-	memset(buf, 0, sizeof(buf));
+static int Myrelease(struct inode *inode, struct file *fileptr)
+{
+	struct seq_file *m = fileptr->private_data;
+	struct my_file *f = m->private;
 
-	return *offset;
-	/****************/
+	free_records(llist_del_all(&f->pending));
+	free_records(f->shown);
+	kfree(f);
+	return single_release(inode, fileptr);
 }
 
 static struct proc_ops Myops = {
-	.proc_read = Myread,
+	.proc_open = Myopen,
+	.proc_read = seq_read,
+	.proc_lseek = seq_lseek,
+	.proc_release = Myrelease,
 	.proc_write = Mywrite,
 };
 
+/*
+ * The event log: a ring of struct my_event per CPU, see my_event.h. Only
+ * the CPU a ring belongs to writes it, with preemption off, so writers
+ * take no lock. A slot's seq is 0 while it is rewritten; readers copy a
+ * slot and keep the copy only if seq was the one expected before and
+ * after, like a seqlock, so they never block the writer either.
+ */
+struct my_slot {
+	unsigned long seq;
+	struct my_event ev;
+};
+
+struct my_ring {
+	unsigned long head; // events written so far
+	struct my_slot slot[RING_SIZE];
+};
+
+static DEFINE_PER_CPU(struct my_ring *, rings);
+
+static ssize_t Myevents_write(struct file *fileptr, const char __user *ubuf,
+			      size_t ubuffer_len, loff_t *offset)
+{
+	struct my_event ev = {
+		.tid = current->pid,
+		.len = min_t(size_t, ubuffer_len, MY_EVENT_PAYLOAD),
+	};
+	struct my_ring *ring;
+	struct my_slot *s;
+
+	if (copy_from_user(ev.payload, ubuf, ev.len))
+		return -EFAULT;
+
+	ev.cpu = get_cpu();
+	ring = per_cpu(rings, ev.cpu);
+	ev.time = ktime_get_ns();
+	ev.seq = ring->head + 1;
+	s = &ring->slot[ring->head & RING_MASK];
+	WRITE_ONCE(s->seq, 0);
+	smp_wmb();
+	s->ev = ev;
+	smp_store_release(&s->seq, ring->head + 1);
+	smp_store_release(&ring->head, ring->head + 1);
+	put_cpu();
+
+	return ubuffer_len;
+}
+
+/* The events this file has not returned yet, as many as fit in ubuf */
+static ssize_t Myevents_read(struct file *fileptr, char __user *ubuf,
+			     size_t buffer_len, loff_t *offset)
+{
+	unsigned long *next = fileptr->private_data; // per CPU
+	size_t done = 0;
+	int cpu;
+
+	if (buffer_len < sizeof(struct my_event))
+		return -EINVAL;
+
+	for_each_possible_cpu(cpu) {
+		struct my_ring *ring = per_cpu(rings, cpu);
+		unsigned long head = smp_load_acquire(&ring->head);
+
+		// fell behind by more than the ring: what is still there
+		if (head - next[cpu] > RING_SIZE)
+			next[cpu] = head - RING_SIZE;
+		for (; next[cpu] != head; next[cpu]++) {
+			struct my_slot *s = &ring->slot[next[cpu] & RING_MASK];
+			unsigned long seq;
+			struct my_event ev;
+
+			if (buffer_len - done < sizeof(ev))
+				goto out;
+			seq = smp_load_acquire(&s->seq);
+			ev = s->ev;
+			smp_rmb();
+			// overwritten or being overwritten: lost
+			if (seq != next[cpu] + 1 || READ_ONCE(s->seq) != seq)
+				continue;
+			if (copy_to_user(ubuf + done, &ev, sizeof(ev)))
+				return done ? done : -EFAULT;
+			done += sizeof(ev);
+		}
+	}
+out:
+	*offset += done;
+	return done;
+}
+
+static int Myevents_open(struct inode *inode, struct file *fileptr)
+{
+	fileptr->private_data = kcalloc(nr_cpu_ids, sizeof(unsigned long),
+					GFP_KERNEL);
+	return fileptr->private_data ? 0 : -ENOMEM;
+}
+
+/* Only back to the start: the oldest events still kept */
+static loff_t Myevents_lseek(struct file *fileptr, loff_t offset, int whence)
+{
+	unsigned long *next = fileptr->private_data;
+
+	if (offset != 0 || whence != SEEK_SET)
+		return -EINVAL;
+	memset(next, 0, nr_cpu_ids * sizeof(*next));
+	fileptr->f_pos = 0;
+	return 0;
+}
+
+static int Myevents_release(struct inode *inode, struct file *fileptr)
+{
+	kfree(fileptr->private_data);
+	return 0;
+}
+
+static struct proc_ops Myevents_ops = {
+	.proc_open = Myevents_open,
+	.proc_read = Myevents_read,
+	.proc_lseek = Myevents_lseek,
+	.proc_release = Myevents_release,
+	.proc_write = Myevents_write,
+};
+
+static void free_rings(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		vfree(per_cpu(rings, cpu));
+		per_cpu(rings, cpu) = NULL;
+	}
+}
+
 static int My_Kernel_Init(void)
 {
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		per_cpu(rings, cpu) = vzalloc(sizeof(struct my_ring));
+		if (!per_cpu(rings, cpu)) {
+			free_rings();
+			return -ENOMEM;
+		}
+	}
+
 	remove_proc_entry(procfs_name, NULL);
 	proc_entry = proc_create(procfs_name, 0644, NULL, &Myops);
-	if (!proc_entry)
+	if (!proc_entry) {
+		free_rings();
+		return -ENOMEM;
+	}
+	events_entry = proc_create(events_name, 0644, NULL, &Myevents_ops);
+	if (!events_entry) {
+		proc_remove(proc_entry);
+		free_rings();
 		return -ENOMEM;
+	}
 
 	pr_info("My kernel says Hi");
 	return 0;
@@ -81,8 +294,10 @@ static int My_Kernel_Init(void)
 
 static void My_Kernel_Exit(void)
 {
-	proc_remove(proc_entry);
 	pr_info("My kernel says GOODBYE");
+	proc_remove(events_entry);
+	proc_remove(proc_entry);
+	free_rings();
 }
 
 module_init(My_Kernel_Init);
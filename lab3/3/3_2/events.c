@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "my_event.h"
+
+/*
+ * Decoder for My_Kernel's event log: prints the binary records of
+ * /proc/Mythread_events (or of a copy of it) one per line, oldest first,
+ * and how many each CPU's ring overwrote before they were read.
+ *
+ * With -f it keeps reading and prints events as they come, unsorted:
+ * reading does not take them out of the log, other readers still get
+ * them.
+ *
+ * usage: events [-f] [file]
+ */
+
+#define MAX_CPUS 65536 // struct my_event's cpu is 16 bits
+
+static unsigned long long last_seq[MAX_CPUS], lost[MAX_CPUS];
+static unsigned long long t0;
+
+static int by_time(const void *a, const void *b)
+{
+	const struct my_event *x = a, *y = b;
+	return (x->time > y->time) - (x->time < y->time);
+}
+
+// a gap in a CPU's seq: events the ring overwrote before this read
+static void count_lost(const struct my_event *e)
+{
+	if (last_seq[e->cpu] != 0 && e->seq > last_seq[e->cpu] + 1)
+		lost[e->cpu] += e->seq - last_seq[e->cpu] - 1;
+	last_seq[e->cpu] = e->seq;
+}
+
+static void print_event(const struct my_event *e)
+{
+	if (t0 == 0)
+		t0 = e->time;
+	printf("%14.3f %4u %8u %10llu  ", (e->time - t0) / 1e3, e->cpu,
+	       e->tid, (unsigned long long)e->seq);
+	for (int i = 0; i < e->len && i < MY_EVENT_PAYLOAD; i++) {
+		unsigned char c = e->payload[i];
+		if (isprint(c) && c != '\\')
+			putchar(c);
+		else
+			printf("\\x%02x", c);
+	}
+	putchar('\n');
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = "/proc/Mythread_events";
+	struct my_event *ev = NULL;
+	size_t n = 0, cap = 0;
+	int opt, follow = 0;
+
+	while ((opt = getopt(argc, argv, "f")) != -1) {
+		if (opt != 'f') {
+			fprintf(stderr, "usage: %s [-f] [file]\n", argv[0]);
+			return 1;
+		}
+		follow = 1;
+	}
+	if (optind < argc)
+		path = argv[optind];
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return 1;
+	}
+
+	printf("%14s %4s %8s %10s  %s\n", "us", "CPU", "TID", "seq",
+	       "payload");
+	for (;;) {
+		if (cap - n < 1024) {
+			cap = cap ? 2 * cap : 4096;
+			ev = realloc(ev, cap * sizeof(*ev));
+			if (ev == NULL) {
+				fprintf(stderr, "out of memory\n");
+				return 1;
+			}
+		}
+		ssize_t got = read(fd, ev + n, (cap - n) * sizeof(*ev));
+		if (got < 0) {
+			perror(path);
+			return 1;
+		}
+		size_t m = got / sizeof(*ev);
+		if (m == 0 && !follow)
+			break;
+		if (m == 0) {
+			usleep(100000);
+			continue;
+		}
+		for (size_t i = n; i < n + m; i++)
+			count_lost(&ev[i]);
+		if (follow) {
+			for (size_t i = n; i < n + m; i++)
+				print_event(&ev[i]);
+			fflush(stdout);
+		} else {
+			n += m;
+		}
+	}
+	close(fd);
+
+	qsort(ev, n, sizeof(*ev), by_time);
+	for (size_t i = 0; i < n; i++)
+		print_event(&ev[i]);
+	if (n > 1 && ev[n - 1].time > ev[0].time)
+		printf("%zu events in %.3f ms, %.0f per second\n", n,
+		       (ev[n - 1].time - ev[0].time) / 1e6,
+		       n / ((ev[n - 1].time - ev[0].time) / 1e9));
+	for (int cpu = 0; cpu < MAX_CPUS; cpu++)
+		if (lost[cpu])
+			printf("CPU %d: %llu events overwritten before they "
+			       "were read\n",
+			       cpu, lost[cpu]);
+	free(ev);
+	return 0;
+}
@@ -0,0 +1,28 @@
+#ifndef MY_EVENT_H
+#define MY_EVENT_H
+
+#include <linux/types.h>
+
+/*
+ * Binary event records of /proc/Mythread_events, shared by My_Kernel.c
+ * and the decoder in events.c.
+ *
+ * Every write() to the file is one event, kept in a ring of the CPU the
+ * writer runs on. A read() returns whole records, those the reading file
+ * has not returned yet, CPU by CPU; seeking to 0 starts over from the
+ * oldest ones still kept. A full ring overwrites its oldest events: the
+ * reader sees a gap in seq.
+ */
+
+#define MY_EVENT_PAYLOAD 40
+
+struct my_event {
+	__u64 seq; // 1, 2, ... per CPU
+	__u64 time; // ns, CLOCK_MONOTONIC
+	__u32 tid;
+	__u16 cpu;
+	__u16 len; // bytes of payload written, the rest of the write is cut
+	char payload[MY_EVENT_PAYLOAD];
+};
+
+#endif
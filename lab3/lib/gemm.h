@@ -0,0 +1,271 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+#include "matrix.h"
+
+/*
+ * Blocked int32 GEMM: C += A * B
+ *
+ * B is packed KC rows by NC columns at a time into NR-wide column
+ * panels (zero padded), so the micro-kernel streams one panel from L1
+ * while C rows ic..ic+MC of A stay in L2. The micro-kernel keeps an
+ * MR x NR tile of C in registers for the whole KC loop: per k it
+ * broadcasts MR values of A and multiply-adds them into the tile.
+ *
+ * The kernel is chosen once from CPUID: AVX-512, AVX2 or plain C.
+ * GEMM_ISA=scalar|avx2|avx512 in the environment forces one (if the
+ * CPU has it), for testing.
+ */
+
+#define GEMM_MR 6 // rows of the register tile
+#define GEMM_NR 16 // columns of the register tile, one packed panel
+#define GEMM_KC 256 // depth of a packed B block, a panel is 16KB
+#define GEMM_MC 96 // rows of A per L2 block, multiple of MR
+#define GEMM_NC 1024 // columns of a packed B block, multiple of NR
+
+/*
+ * tile c (MR x NR, row stride ldc) += a * bp, where a[r] points at
+ * row r of A at the block's first k and bp is a kc x NR panel
+ */
+typedef void (*gemm_kernel_fn)(int kc, const int *const *a, const int *bp,
+			       int *c, int ldc);
+
+struct gemm_isa {
+	const char *name;
+	gemm_kernel_fn kernel;
+	int (*supported)();
+};
+
+static void gemm_kernel_scalar(int kc, const int *const *a, const int *bp,
+			       int *c, int ldc)
+{
+	// unsigned, so that it wraps modulo 2^32 like the SIMD kernels
+	unsigned acc[GEMM_MR][GEMM_NR] = { 0 };
+	for (int k = 0; k < kc; k++, bp += GEMM_NR)
+		for (int r = 0; r < GEMM_MR; r++) {
+			unsigned ar = a[r][k];
+			for (int j = 0; j < GEMM_NR; j++)
+				acc[r][j] += ar * (unsigned)bp[j];
+		}
+	for (int r = 0; r < GEMM_MR; r++)
+		for (int j = 0; j < GEMM_NR; j++)
+			((unsigned *)c)[r * ldc + j] += acc[r][j];
+}
+
+__attribute__((target("avx2"))) static void
+gemm_kernel_avx2(int kc, const int *const *a, const int *bp, int *c, int ldc)
+{
+	__m256i acc[GEMM_MR][2];
+#pragma GCC unroll 6
+	for (int r = 0; r < GEMM_MR; r++)
+		acc[r][0] = acc[r][1] = _mm256_setzero_si256();
+	for (int k = 0; k < kc; k++, bp += GEMM_NR) {
+		__m256i b0 = _mm256_load_si256((const __m256i *)bp);
+		__m256i b1 = _mm256_load_si256((const __m256i *)(bp + 8));
+#pragma GCC unroll 6
+		for (int r = 0; r < GEMM_MR; r++) {
+			__m256i ar = _mm256_set1_epi32(a[r][k]);
+			__m256i p0 = _mm256_mullo_epi32(ar, b0);
+			__m256i p1 = _mm256_mullo_epi32(ar, b1);
+			acc[r][0] = _mm256_add_epi32(acc[r][0], p0);
+			acc[r][1] = _mm256_add_epi32(acc[r][1], p1);
+		}
+	}
+#pragma GCC unroll 6
+	for (int r = 0; r < GEMM_MR; r++) {
+		__m256i *cr = (__m256i *)(c + r * ldc);
+		_mm256_storeu_si256(cr, _mm256_add_epi32(_mm256_loadu_si256(cr),
+							 acc[r][0]));
+		_mm256_storeu_si256(cr + 1,
+				    _mm256_add_epi32(_mm256_loadu_si256(cr + 1),
+						     acc[r][1]));
+	}
+}
+
+__attribute__((target("avx512f"))) static void
+gemm_kernel_avx512(int kc, const int *const *a, const int *bp, int *c,
+		   int ldc)
+{
+	__m512i acc[GEMM_MR];
+#pragma GCC unroll 6
+	for (int r = 0; r < GEMM_MR; r++)
+		acc[r] = _mm512_setzero_si512();
+	for (int k = 0; k < kc; k++, bp += GEMM_NR) {
+		__m512i b = _mm512_load_si512(bp);
+#pragma GCC unroll 6
+		for (int r = 0; r < GEMM_MR; r++)
+			acc[r] = _mm512_add_epi32(
+				acc[r],
+				_mm512_mullo_epi32(_mm512_set1_epi32(a[r][k]),
+						   b));
+	}
+#pragma GCC unroll 6
+	for (int r = 0; r < GEMM_MR; r++)
+		_mm512_storeu_si512(c + r * ldc,
+				    _mm512_add_epi32(
+					    _mm512_loadu_si512(c + r * ldc),
+					    acc[r]));
+}
+
+static int gemm_has_scalar()
+{
+	return 1;
+}
+
+static int gemm_has_avx2()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+static int gemm_has_avx512()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx512f");
+}
+
+// best first
+static const struct gemm_isa gemm_isas[] = {
+	{ "avx512", gemm_kernel_avx512, gemm_has_avx512 },
+	{ "avx2", gemm_kernel_avx2, gemm_has_avx2 },
+	{ "scalar", gemm_kernel_scalar, gemm_has_scalar },
+};
+
+#define GEMM_NUM_ISAS (int)(sizeof(gemm_isas) / sizeof(gemm_isas[0]))
+
+/* The first call has to come before any threads use gemm */
+static inline const struct gemm_isa *gemm_select()
+{
+	static const struct gemm_isa *isa;
+	if (isa)
+		return isa;
+
+	const char *want = getenv("GEMM_ISA");
+	for (int i = 0; i < GEMM_NUM_ISAS && !isa; i++)
+		if (gemm_isas[i].supported() &&
+		    (!want || !strcmp(want, gemm_isas[i].name)))
+			isa = &gemm_isas[i];
+	if (!isa)
+		isa = &gemm_isas[GEMM_NUM_ISAS - 1];
+	return isa;
+}
+
+/* bp = B[k0:k0+kc, j0:j0+nc] as NR-wide panels, zero padded */
+static inline void gemm_pack_b(int *bp, const struct matrix *b, int k0,
+			       int kc, int j0, int nc)
+{
+	for (int jp = 0; jp < nc; jp += GEMM_NR) {
+		int w = nc - jp < GEMM_NR ? nc - jp : GEMM_NR;
+		for (int k = 0; k < kc; k++, bp += GEMM_NR) {
+			const int *src = mat_row(b, k0 + k) + j0 + jp;
+			memcpy(bp, src, w * sizeof(int));
+			memset(bp + w, 0, (GEMM_NR - w) * sizeof(int));
+		}
+	}
+}
+
+/*
+ * C[ic:ic+mc, jc:jc+nc] += A[ic:ic+mc, pc:pc+kc] * packed B block. Tiles
+ * write all NR columns: C rows are padded to a cache line (a multiple
+ * of NR) and the padding columns of B are zero, so they only add 0.
+ * Short tiles at the bottom go through a scratch tile, the rows below
+ * belong to somebody else.
+ */
+static inline void gemm_block(const struct gemm_isa *isa, struct matrix *c,
+			      const struct matrix *a, const int *bp, int ic,
+			      int mc, int pc, int kc, int jc, int nc)
+{
+	int tile[GEMM_MR * GEMM_NR] __attribute__((aligned(MATRIX_ALIGN)));
+	const int *ap[GEMM_MR];
+
+	for (int jr = 0; jr < nc; jr += GEMM_NR) {
+		const int *panel = bp + (size_t)jr * kc;
+		for (int ir = 0; ir < mc; ir += GEMM_MR) {
+			int h = mc - ir < GEMM_MR ? mc - ir : GEMM_MR;
+			// a short tile repeats its last row
+			for (int r = 0; r < GEMM_MR; r++) {
+				int row = ic + ir + (r < h ? r : h - 1);
+				ap[r] = mat_row(a, row) + pc;
+			}
+			int *ct = mat_row(c, ic + ir) + jc + jr;
+			if (h == GEMM_MR) {
+				isa->kernel(kc, ap, panel, ct, c->stride);
+				continue;
+			}
+			memset(tile, 0, sizeof(tile));
+			isa->kernel(kc, ap, panel, tile, GEMM_NR);
+			for (int r = 0; r < h; r++, ct += c->stride)
+				for (int j = 0; j < GEMM_NR; j++)
+					ct[j] += tile[r * GEMM_NR + j];
+		}
+	}
+}
+
+/*
+ * C[r0:r1, c0:c1] += A[r0:r1, :] * B[:, c0:c1] with the kernel of isa.
+ * Different threads can compute disjoint tiles of C at the same time,
+ * as long as c0 and c1 (unless it is the last column) are multiples of
+ * GEMM_NR: a tile writes whole NR-wide column panels. Return 0, or -1
+ * when out of memory.
+ */
+static inline int gemm_tile_isa(const struct gemm_isa *isa, struct matrix *c,
+				const struct matrix *a, const struct matrix *b,
+				int r0, int r1, int c0, int c1)
+{
+	int width = c1 - c0 < GEMM_NC ? c1 - c0 : GEMM_NC;
+	width = (width + GEMM_NR - 1) / GEMM_NR * GEMM_NR;
+	int *bp = aligned_alloc(MATRIX_ALIGN,
+				(size_t)GEMM_KC * (width ? width : GEMM_NR) *
+					sizeof(int));
+	if (bp == NULL)
+		return -1;
+
+	for (int jc = c0; jc < c1; jc += GEMM_NC) {
+		int nc = c1 - jc < GEMM_NC ? c1 - jc : GEMM_NC;
+		for (int pc = 0; pc < a->cols; pc += GEMM_KC) {
+			int kc = a->cols - pc;
+			kc = kc < GEMM_KC ? kc : GEMM_KC;
+			gemm_pack_b(bp, b, pc, kc, jc, nc);
+			for (int ic = r0; ic < r1; ic += GEMM_MC) {
+				int mc = r1 - ic < GEMM_MC ? r1 - ic : GEMM_MC;
+				gemm_block(isa, c, a, bp, ic, mc, pc, kc, jc,
+					   nc);
+			}
+		}
+	}
+	free(bp);
+	return 0;
+}
+
+static inline int gemm_tile(struct matrix *c, const struct matrix *a,
+			    const struct matrix *b, int r0, int r1, int c0,
+			    int c1)
+{
+	return gemm_tile_isa(gemm_select(), c, a, b, r0, r1, c0, c1);
+}
+
+/* Rows r0..r1 of C += rows r0..r1 of A times B */
+static inline int gemm_rows_isa(const struct gemm_isa *isa, struct matrix *c,
+				const struct matrix *a, const struct matrix *b,
+				int r0, int r1)
+{
+	return gemm_tile_isa(isa, c, a, b, r0, r1, 0, b->cols);
+}
+
+static inline int gemm_rows(struct matrix *c, const struct matrix *a,
+			    const struct matrix *b, int r0, int r1)
+{
+	return gemm_rows_isa(gemm_select(), c, a, b, r0, r1);
+}
+
+/* C += A * B, return 0, or -1 when out of memory */
+static inline int gemm(struct matrix *c, const struct matrix *a,
+		       const struct matrix *b)
+{
+	return gemm_rows(c, a, b, 0, a->rows);
+}
+
+#endif
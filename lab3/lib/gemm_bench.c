@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "gemm.h"
+
+/*
+ * GEMM check and benchmark
+ *
+ * Every kernel the CPU supports is compared with the naive i-j-k loop
+ * on shapes that hit all the edge cases (short tiles, partial panels,
+ * several KC/NC blocks), then timed on the 1234x250 by 250x1234
+ * product of 3_2.c, next to the naive loop and the transposed dot
+ * product the lab programs used before.
+ *
+ * usage: gemm_bench [runs]
+ */
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fill(struct matrix *m, int rows, int cols)
+{
+	if (mat_alloc(m, rows, cols) < 0) {
+		printf("Out of memory\n");
+		exit(1);
+	}
+	for (int i = 0; i < rows; i++)
+		for (int j = 0; j < cols; j++)
+			MAT(m, i, j) = rand() % 2001 - 1000;
+}
+
+static void naive(struct matrix *c, const struct matrix *a,
+		  const struct matrix *b)
+{
+	for (int i = 0; i < a->rows; i++)
+		for (int j = 0; j < b->cols; j++)
+			for (int k = 0; k < a->cols; k++)
+				MAT(c, i, j) += MAT(a, i, k) * MAT(b, k, j);
+}
+
+static void transposed(struct matrix *c, const struct matrix *a,
+		       const struct matrix *b)
+{
+	struct matrix bt;
+	mat_transpose(&bt, b);
+	for (int i = 0; i < a->rows; i++)
+		for (int j = 0; j < b->cols; j++)
+			MAT(c, i, j) +=
+				mat_dot(mat_row(a, i), mat_row(&bt, j), a->cols);
+	mat_free(&bt);
+}
+
+// return the number of wrong elements
+static int check(const struct gemm_isa *isa, int m, int k, int n)
+{
+	struct matrix a, b, want, got;
+	int bad = 0;
+
+	fill(&a, m, k);
+	fill(&b, k, n);
+	fill(&want, m, n); // C += A * B: start from the same non-zero C
+	mat_alloc(&got, m, n);
+	for (int i = 0; i < m; i++)
+		memcpy(mat_row(&got, i), mat_row(&want, i), n * sizeof(int));
+	naive(&want, &a, &b);
+	// two row ranges, as two threads would
+	gemm_rows_isa(isa, &got, &a, &b, 0, m / 3);
+	gemm_rows_isa(isa, &got, &a, &b, m / 3, m);
+	for (int i = 0; i < m; i++)
+		bad += memcmp(mat_row(&got, i), mat_row(&want, i),
+			      n * sizeof(int)) != 0;
+	mat_free(&a);
+	mat_free(&b);
+	mat_free(&want);
+	mat_free(&got);
+	return bad;
+}
+
+static double best_of(int runs, const struct gemm_isa *isa,
+		      void (*fn)(struct matrix *, const struct matrix *,
+				 const struct matrix *),
+		      const struct matrix *a, const struct matrix *b)
+{
+	double best = 1e30;
+	for (int r = 0; r < runs; r++) {
+		struct matrix c;
+		mat_alloc(&c, a->rows, b->cols);
+		double t = now();
+		if (isa)
+			gemm_rows_isa(isa, &c, a, b, 0, a->rows);
+		else
+			fn(&c, a, b);
+		t = now() - t;
+		best = t < best ? t : best;
+		mat_free(&c);
+	}
+	return best;
+}
+
+static void report(const char *name, double t, int m, int k, int n)
+{
+	printf("%-12s %10.2f %10.2f\n", name, t * 1e3,
+	       2.0 * m * k * n / t / 1e9);
+}
+
+int main(int argc, char *argv[])
+{
+	static const int shapes[][3] = {
+		{ 1, 1, 1 },	   { 5, 7, 3 },	      { 6, 16, 16 },
+		{ 7, 17, 15 },	   { 97, 300, 33 },   { 100, 513, 1030 },
+		{ 1234, 250, 4 }, { 1234, 250, 1234 },
+	};
+	int nshapes = sizeof(shapes) / sizeof(shapes[0]);
+	int runs = argc > 1 ? atoi(argv[1]) : 5;
+	int failed = 0;
+
+	srand(1);
+	printf("selected: %s\n", gemm_select()->name);
+	for (int i = 0; i < GEMM_NUM_ISAS; i++) {
+		const struct gemm_isa *isa = &gemm_isas[i];
+		if (!isa->supported()) {
+			printf("%-12s not supported\n", isa->name);
+			continue;
+		}
+		int bad = 0;
+		for (int s = 0; s < nshapes; s++)
+			bad += check(isa, shapes[s][0], shapes[s][1],
+				     shapes[s][2]);
+		printf("%-12s %s\n", isa->name,
+		       bad ? "MISMATCH against naive" : "matches naive");
+		failed |= bad;
+	}
+
+	struct matrix a, b;
+	int m = 1234, k = 250, n = 1234;
+	fill(&a, m, k);
+	fill(&b, k, n);
+	printf("\n%dx%d * %dx%d, best of %d\n", m, k, k, n, runs);
+	printf("%-12s %10s %10s\n", "kernel", "ms", "Gop/s");
+	report("naive", best_of(runs, NULL, naive, &a, &b), m, k, n);
+	report("transposed", best_of(runs, NULL, transposed, &a, &b), m, k, n);
+	for (int i = 0; i < GEMM_NUM_ISAS; i++)
+		if (gemm_isas[i].supported())
+			report(gemm_isas[i].name,
+			       best_of(runs, &gemm_isas[i], NULL, &a, &b), m, k,
+			       n);
+	mat_free(&a);
+	mat_free(&b);
+	return failed ? 1 : 0;
+}
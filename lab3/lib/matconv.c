@@ -0,0 +1,41 @@
+#include <stdio.h>
+#include <unistd.h>
+#include "matrix_types.h"
+
+/*
+ * Matrix file converter: a text matrix ("rows cols" header, then the
+ * numbers) becomes a binary one and a binary one becomes text, by what
+ * the input turns out to be. Text is read as int32 unless -t says
+ * int64, float or double; a binary file carries its type.
+ *
+ * The lab programs pick up m1.bin instead of m1.txt when it is there
+ * and not older, see mat_load_input().
+ *
+ * usage: matconv [-t type] in out
+ */
+
+int main(int argc, char *argv[])
+{
+	int opt, dtype = 0;
+
+	while ((opt = getopt(argc, argv, "t:")) != -1) {
+		if (opt != 't' || !(dtype = mat_dtype_parse(optarg))) {
+			dtype = -1;
+			break;
+		}
+	}
+	if (dtype < 0 || argc - optind != 2) {
+		fprintf(stderr,
+			"usage: %s [-t int32|int64|float|double] in out\n",
+			argv[0]);
+		return 1;
+	}
+	const char *in = argv[optind], *out = argv[optind + 1];
+	int file_dtype = mat_file_dtype(in);
+	if (file_dtype < 0)
+		return 1;
+	if (file_dtype == 0)
+		return mat_convert(dtype ? dtype : MAT_INT32, in, out, true) ?
+			       1 : 0;
+	return mat_convert(file_dtype, in, out, false) < 0 ? 1 : 0;
+}
@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "matrix_types.h"
+
+/*
+ * Multiply two matrix files of any size: out = a * b
+ *
+ * The sizes come from the files, a needs as many columns as b has
+ * rows. The elements are int32, int64, float or double: the type of a
+ * if it is a binary file, int64 for text so that sums do not overflow,
+ * or what -t says. out is written in binary if its name ends in .bin,
+ * as text otherwise.
+ *
+ * usage: matmul [-t type] [-j threads] a b out
+ */
+
+int main(int argc, char *argv[])
+{
+	int opt, dtype = 0, nthreads = pool_default_threads();
+	bool bad = false;
+
+	while ((opt = getopt(argc, argv, "t:j:")) != -1) {
+		if (opt == 't')
+			bad |= !(dtype = mat_dtype_parse(optarg));
+		else if (opt == 'j')
+			bad |= (nthreads = atoi(optarg)) < 1;
+		else
+			bad = true;
+	}
+	if (bad || argc - optind != 3) {
+		fprintf(stderr,
+			"usage: %s [-t int32|int64|float|double] [-j threads] "
+			"a b out\n",
+			argv[0]);
+		return 1;
+	}
+	const char *a = argv[optind], *b = argv[optind + 1];
+	if (!dtype) {
+		int file_dtype = mat_file_dtype(a);
+		if (file_dtype < 0)
+			return 1;
+		dtype = file_dtype ? file_dtype : MAT_INT64;
+	}
+	return matmul(dtype, a, b, argv[optind + 2], nthreads) < 0 ? 1 : 0;
+}
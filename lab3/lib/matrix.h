@@ -0,0 +1,102 @@
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/*
+ * Dense int matrix in one cache-line aligned, zeroed allocation.
+ * Rows are stored one after the other; each row starts on a cache line
+ * (stride is cols rounded up), so walking a row is a sequential scan
+ * and a row is never shared between two threads' cache lines.
+ * A matrix loaded from a binary file (matrix_io.h) keeps the same
+ * layout but its data lives in the file's private mapping.
+ */
+
+#define MATRIX_ALIGN 64
+#define MATRIX_ROW_INTS (MATRIX_ALIGN / sizeof(int))
+
+struct matrix {
+	int rows, cols;
+	int stride; // ints from one row to the next
+	int *data;
+	// data points into this mmapped file instead of the heap
+	void *map;
+	size_t map_len;
+};
+
+/* Return 0, or -1 when out of memory */
+static inline int mat_alloc(struct matrix *m, int rows, int cols)
+{
+	m->rows = rows;
+	m->cols = cols;
+	m->stride = (cols + MATRIX_ROW_INTS - 1) / MATRIX_ROW_INTS *
+		    MATRIX_ROW_INTS;
+	m->map = NULL;
+	m->map_len = 0;
+	size_t size = (size_t)rows * m->stride * sizeof(int);
+	m->data = aligned_alloc(MATRIX_ALIGN, size ? size : MATRIX_ALIGN);
+	if (m->data == NULL)
+		return -1;
+	memset(m->data, 0, size);
+	return 0;
+}
+
+static inline void mat_free(struct matrix *m)
+{
+	if (m->map)
+		munmap(m->map, m->map_len);
+	else
+		free(m->data);
+	m->data = NULL;
+	m->map = NULL;
+}
+
+static inline int *mat_row(const struct matrix *m, int i)
+{
+	return m->data + (size_t)i * m->stride;
+}
+
+#define MAT(m, i, j) (mat_row(m, i)[j])
+
+/*
+ * v = the rows x cols block of m at (r0, c0), sharing m's data and
+ * stride. A view is never passed to mat_free().
+ */
+static inline void mat_view(struct matrix *v, const struct matrix *m, int r0,
+			    int c0, int rows, int cols)
+{
+	v->rows = rows;
+	v->cols = cols;
+	v->stride = m->stride;
+	v->data = mat_row(m, r0) + c0;
+	v->map = NULL;
+	v->map_len = 0;
+}
+
+/*
+ * t = m^T, so that column j of m is the contiguous row j of t: the
+ * inner loop of x * y becomes a dot product of two rows
+ */
+static inline int mat_transpose(struct matrix *t, const struct matrix *m)
+{
+	if (mat_alloc(t, m->cols, m->rows) < 0)
+		return -1;
+	for (int i = 0; i < m->rows; i++) {
+		const int *r = mat_row(m, i);
+		for (int j = 0; j < m->cols; j++)
+			MAT(t, j, i) = r[j];
+	}
+	return 0;
+}
+
+static inline int mat_dot(const int *a, const int *b, int n)
+{
+	int res = 0;
+	for (int k = 0; k < n; k++)
+		res += a[k] * b[k];
+	return res;
+}
+
+#endif
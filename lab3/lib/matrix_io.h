@@ -0,0 +1,751 @@
+#ifndef MATRIX_IO_H
+#define MATRIX_IO_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "matrix.h"
+#include "pool.h"
+
+/*
+ * Loading the lab's matrix files: a "rows cols" header, then the
+ * numbers. The file is mmapped and scanned by hand instead of one
+ * fscanf per number. Binary matrix files (below) are recognised by
+ * their magic and used without parsing.
+ *
+ * When the file is big enough for several threads and holds exactly
+ * one row per line, the body is split on line boundaries, one chunk
+ * per thread, and every line must hold exactly cols numbers. Anything
+ * else is read by one thread in free format, like fscanf would.
+ * Errors are reported on stderr with the file name and line.
+ */
+
+#define MAT_LOAD_CHUNK (256 << 10) // bytes per parser thread at least
+
+struct mat_load_chunk {
+	const char *begin, *end;
+	int row; // of the first line
+	int bad_row; // first row that failed to parse, or -1
+};
+
+struct mat_load_job {
+	struct matrix *m;
+	struct mat_load_chunk *chunks;
+};
+
+static inline bool mat_blank(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char *mat_skip(const char *p, const char *end,
+				   bool newlines)
+{
+	while (p < end && (mat_blank(*p) || (newlines && *p == '\n')))
+		p++;
+	return p;
+}
+
+/* *v = the number at p, return the end of it, or NULL if p has none */
+static inline const char *mat_int(const char *p, const char *end, int *v)
+{
+	bool neg = false;
+	long n = 0;
+
+	if (p < end && (*p == '-' || *p == '+'))
+		neg = *p++ == '-';
+	if (p == end || (unsigned)(*p - '0') > 9)
+		return NULL;
+	do {
+		n = n * 10 + (*p++ - '0');
+		if (n > (long)INT_MAX + 1)
+			return NULL;
+	} while (p < end && (unsigned)(*p - '0') <= 9);
+	if (n > INT_MAX && !neg)
+		return NULL;
+	// "12a" is not a number either
+	if (p < end && !mat_blank(*p) && *p != '\n')
+		return NULL;
+	*v = neg ? -n : n;
+	return p;
+}
+
+/* Parse the n numbers of one line at p, return the next line or NULL */
+static inline const char *mat_line(const char *p, const char *end, int *v,
+				   int n)
+{
+	for (int j = 0; j < n; j++) {
+		p = mat_skip(p, end, false);
+		if ((p = mat_int(p, end, &v[j])) == NULL)
+			return NULL;
+	}
+	p = mat_skip(p, end, false);
+	if (p < end && *p++ != '\n')
+		return NULL;
+	return p;
+}
+
+static void mat_load_chunk(void *arg, int task, int worker)
+{
+	struct mat_load_job *job = (struct mat_load_job *)arg;
+	struct mat_load_chunk *c = &job->chunks[task];
+	const char *p = c->begin;
+
+	for (int i = c->row; p < c->end; i++) {
+		p = mat_line(p, c->end, mat_row(job->m, i), job->m->cols);
+		if (p == NULL) {
+			c->bad_row = i;
+			return;
+		}
+	}
+}
+
+// number of lines in [p, end), the last one need not end with '\n'
+static inline int mat_count_lines(const char *p, const char *end)
+{
+	int n = 0;
+	while ((p = memchr(p, '\n', end - p)) != NULL) {
+		n++;
+		p++;
+	}
+	return n;
+}
+
+/* One line per row, in parallel; 1 if the file is not laid out that way */
+static inline int mat_load_lines(struct matrix *m, const char *path,
+				 const char *p, const char *end, int nthreads)
+{
+	struct mat_load_chunk chunks[nthreads];
+	struct mat_load_job job = { m, chunks };
+	int lines = 0;
+
+	for (int t = 0; t < nthreads; t++) {
+		chunks[t].begin = t ? chunks[t - 1].end : p;
+		chunks[t].end = end;
+		if (t + 1 < nthreads) {
+			const char *cut = p + (end - p) * (t + 1) / nthreads;
+			if (cut < chunks[t].begin)
+				cut = chunks[t].begin;
+			const char *nl = memchr(cut, '\n', end - cut);
+			chunks[t].end = nl ? nl + 1 : end;
+		}
+		chunks[t].row = lines;
+		chunks[t].bad_row = -1;
+		lines += mat_count_lines(chunks[t].begin, chunks[t].end);
+	}
+	if (lines + 1 != m->rows)
+		return 1;
+
+	struct pool pool = { .nthreads = nthreads,
+			     .task = mat_load_chunk,
+			     .arg = &job };
+	int ret = pool_run(&pool, nthreads);
+	pool_free(&pool);
+	if (ret < 0) {
+		fprintf(stderr, "%s: out of memory\n", path);
+		return -1;
+	}
+	for (int t = 0; t < nthreads; t++)
+		if (chunks[t].bad_row >= 0) {
+			// line 1 is the header
+			fprintf(stderr, "%s:%d: expected %d numbers\n", path,
+				chunks[t].bad_row + 2, m->cols);
+			return -1;
+		}
+	return 0;
+}
+
+/* Free format, rows * cols numbers separated by any white space */
+static inline int mat_load_free(struct matrix *m, const char *path,
+				const char *p, const char *end)
+{
+	for (int i = 0; i < m->rows; i++) {
+		int *r = mat_row(m, i);
+		for (int j = 0; j < m->cols; j++) {
+			p = mat_skip(p, end, true);
+			if ((p = mat_int(p, end, &r[j])) == NULL) {
+				fprintf(stderr,
+					"%s: bad or missing number %d of %d\n",
+					path, i * m->cols + j + 1,
+					m->rows * m->cols);
+				return -1;
+			}
+		}
+	}
+	if (mat_skip(p, end, true) != end) {
+		fprintf(stderr, "%s: more than %d numbers\n", path,
+			m->rows * m->cols);
+		return -1;
+	}
+	return 0;
+}
+
+static inline int mat_check_dims(const char *path, int hr, int hc, int rows,
+				 int cols)
+{
+	if ((rows && hr != rows) || (cols && hc != cols)) {
+		fprintf(stderr, "%s: header says %dx%d, expected %dx%d\n", path,
+			hr, hc, rows ? rows : hr, cols ? cols : hc);
+		return -1;
+	}
+	return 0;
+}
+
+/* Parse the "rows cols" line at *p and move *p past it, return 0 or -1 */
+static inline int mat_text_header(const char *path, const char **p,
+				  const char *end, int *rows, int *cols)
+{
+	const char *q = mat_skip(*p, end, true);
+	if ((q = mat_int(q, end, rows)) == NULL ||
+	    (q = mat_line(q, end, cols, 1)) == NULL || *rows <= 0 ||
+	    *cols <= 0) {
+		fprintf(stderr, "%s:1: expected a \"rows cols\" header\n",
+			path);
+		return -1;
+	}
+	*p = q;
+	return 0;
+}
+
+static inline int mat_load_text(struct matrix *m, const char *path,
+				const char *p, const char *end, int rows,
+				int cols)
+{
+	int hr, hc, ret = 1;
+
+	madvise((void *)p, end - p, MADV_SEQUENTIAL);
+	if (mat_text_header(path, &p, end, &hr, &hc) < 0 ||
+	    mat_check_dims(path, hr, hc, rows, cols) < 0)
+		return -1;
+	if (mat_alloc(m, hr, hc) < 0) {
+		fprintf(stderr, "%s: out of memory\n", path);
+		return -1;
+	}
+
+	// trailing white space is not a line
+	while (end > p && (mat_blank(end[-1]) || end[-1] == '\n'))
+		end--;
+	int nthreads = (end - p) / MAT_LOAD_CHUNK;
+	if (nthreads > pool_default_threads())
+		nthreads = pool_default_threads();
+	if (nthreads > hr)
+		nthreads = hr;
+	if (nthreads > 1)
+		ret = mat_load_lines(m, path, p, end, nthreads);
+	if (ret > 0)
+		ret = mat_load_free(m, path, p, end);
+	if (ret < 0)
+		mat_free(m);
+	return ret;
+}
+
+/*
+ * Binary matrix file: this header, then the rows at offset, each
+ * stride elements apart, in the byte order of the machine (x86, little
+ * endian). matconv converts text files to it and back.
+ */
+#define MAT_BIN_MAGIC "LAB3MAT" // with its NUL, 8 bytes
+#define MAT_BIN_VERSION 1
+
+enum mat_dtype {
+	MAT_INT32 = 1,
+	MAT_INT64,
+	MAT_FLOAT32,
+	MAT_FLOAT64,
+};
+
+static const char *const mat_dtype_names[] = {
+	[MAT_INT32] = "int32",
+	[MAT_INT64] = "int64",
+	[MAT_FLOAT32] = "float",
+	[MAT_FLOAT64] = "double",
+};
+
+#define MAT_NUM_DTYPES (int)(sizeof(mat_dtype_names) / sizeof(char *))
+
+static inline const char *mat_dtype_name(uint32_t dtype)
+{
+	return dtype && dtype < MAT_NUM_DTYPES ? mat_dtype_names[dtype] : "?";
+}
+
+/* The dtype called name, or 0 */
+static inline int mat_dtype_parse(const char *name)
+{
+	for (int t = 1; t < MAT_NUM_DTYPES; t++)
+		if (!strcmp(name, mat_dtype_names[t]))
+			return t;
+	return 0;
+}
+
+struct mat_bin_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t dtype;
+	uint32_t rows, cols;
+	uint32_t stride; // elements from one row to the next
+	uint32_t align; // of the data and of every row, in bytes
+	uint64_t offset; // of the data, from the start of the file
+	char pad[24];
+};
+
+_Static_assert(sizeof(struct mat_bin_header) == 64, "header is 64 bytes");
+
+static inline bool mat_is_bin(const char *map, size_t size)
+{
+	return size >= sizeof(struct mat_bin_header) &&
+	       !memcmp(map, MAT_BIN_MAGIC, sizeof(MAT_BIN_MAGIC));
+}
+
+/*
+ * Copy the header of the binary file mapped at map into h and check it
+ * for elements of dtype, esize bytes each, and for the dimensions the
+ * caller expects. Return 0, or -1 after printing what is wrong.
+ */
+static inline int mat_bin_header(struct mat_bin_header *h, const char *path,
+				 const char *map, size_t size, uint32_t dtype,
+				 size_t esize, int rows, int cols)
+{
+	memcpy(h, map, sizeof(*h));
+	if (h->version != MAT_BIN_VERSION) {
+		fprintf(stderr, "%s: unsupported version %u\n", path,
+			h->version);
+		return -1;
+	}
+	if (h->dtype != dtype) {
+		fprintf(stderr, "%s: holds %s, not %s\n", path,
+			mat_dtype_name(h->dtype), mat_dtype_name(dtype));
+		return -1;
+	}
+	if (h->rows == 0 || h->cols == 0 || h->rows > INT_MAX ||
+	    h->cols > INT_MAX || h->stride < h->cols || h->stride > INT_MAX ||
+	    h->offset < sizeof(*h) || h->offset > size ||
+	    (size - h->offset) / esize / h->stride < h->rows) {
+		fprintf(stderr, "%s: corrupt header or truncated data\n", path);
+		return -1;
+	}
+	return mat_check_dims(path, h->rows, h->cols, rows, cols);
+}
+
+/* The dtype of the binary matrix file at path, 0 for text, -1 on error */
+static inline int mat_file_dtype(const char *path)
+{
+	struct mat_bin_header h;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	ssize_t n = fd < 0 ? -1 : read(fd, &h, sizeof(h));
+	if (n < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	close(fd);
+	if (!mat_is_bin((const char *)&h, n))
+		return 0;
+	return h.dtype;
+}
+
+/*
+ * Map the file at path private and writable, so that a matrix used in
+ * place can still be changed. Return the mapping, or NULL after
+ * printing why.
+ */
+static inline char *mat_map(const char *path, size_t *size)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return NULL;
+	}
+	if (st.st_size == 0) {
+		fprintf(stderr, "%s: empty file\n", path);
+		close(fd);
+		return NULL;
+	}
+	char *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+			 fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	*size = st.st_size;
+	return map;
+}
+
+/*
+ * A binary file whose rows are aligned like ours is used in place: m
+ * takes over the mapping and nothing is parsed or copied. Return 0 then,
+ * 1 after copying it into m, or -1.
+ */
+static inline int mat_load_bin(struct matrix *m, const char *path, char *map,
+			       size_t size, int rows, int cols)
+{
+	struct mat_bin_header h;
+	if (mat_bin_header(&h, path, map, size, MAT_INT32, sizeof(int), rows,
+			   cols) < 0)
+		return -1;
+
+	if (h.offset % MATRIX_ALIGN == 0 &&
+	    h.stride * sizeof(int) % MATRIX_ALIGN == 0) {
+		m->rows = h.rows;
+		m->cols = h.cols;
+		m->stride = h.stride;
+		m->data = (int *)(map + h.offset);
+		m->map = map;
+		m->map_len = size;
+		return 0;
+	}
+	if (mat_alloc(m, h.rows, h.cols) < 0) {
+		fprintf(stderr, "%s: out of memory\n", path);
+		return -1;
+	}
+	for (int i = 0; i < m->rows; i++)
+		memcpy(mat_row(m, i),
+		       map + h.offset + (size_t)i * h.stride * sizeof(int),
+		       m->cols * sizeof(int));
+	return 1;
+}
+
+/*
+ * Read the matrix file at path, text or binary, into m. rows and cols
+ * are what the caller expects, the header has to match them; 0 takes
+ * the header's. Return 0, or -1 after printing what is wrong.
+ */
+static inline int mat_load(struct matrix *m, const char *path, int rows,
+			   int cols)
+{
+	size_t size;
+	char *map = mat_map(path, &size);
+	if (map == NULL)
+		return -1;
+
+	int ret;
+	if (mat_is_bin(map, size)) {
+		ret = mat_load_bin(m, path, map, size, rows, cols);
+		if (ret == 0)
+			return 0; // m owns the mapping now
+	} else {
+		ret = mat_load_text(m, path, map, map + size, rows, cols);
+	}
+	munmap(map, size);
+	return ret < 0 ? -1 : 0;
+}
+
+static inline bool mat_older(const struct stat *a, const struct stat *b)
+{
+	return a->st_mtim.tv_sec < b->st_mtim.tv_sec ||
+	       (a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+		a->st_mtim.tv_nsec < b->st_mtim.tv_nsec);
+}
+
+/*
+ * Load path, or the binary file next to it (m1.txt -> m1.bin) if there
+ * is one that is not older, so that inputs converted once with matconv
+ * are not parsed again on every run
+ */
+static inline int mat_load_input(struct matrix *m, const char *path, int rows,
+				 int cols)
+{
+	char bin[PATH_MAX];
+	const char *dot = strrchr(path, '.');
+	size_t stem = dot && !strchr(dot, '/') ? dot - path : strlen(path);
+	struct stat t, b;
+
+	if (stem + sizeof(".bin") <= sizeof(bin)) {
+		memcpy(bin, path, stem);
+		strcpy(bin + stem, ".bin");
+		if (strcmp(bin, path) && stat(bin, &b) == 0 &&
+		    (stat(path, &t) < 0 || !mat_older(&b, &t)))
+			return mat_load(m, bin, rows, cols);
+	}
+	return mat_load(m, path, rows, cols);
+}
+
+/*
+ * Load the factors of a * b with mat_load_input(), whatever their size
+ * as long as a has as many columns as b has rows
+ */
+static inline int mat_load_factors(struct matrix *a, const char *a_path,
+				   struct matrix *b, const char *b_path)
+{
+	if (mat_load_input(a, a_path, 0, 0) < 0)
+		return -1;
+	if (mat_load_input(b, b_path, a->cols, 0) < 0) {
+		mat_free(a);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Write a binary matrix file of rows x cols elements of dtype, esize
+ * bytes each, that are stride elements apart in data. Every row is
+ * padded to out_stride elements in the file. Return 0, or -1 after
+ * printing why.
+ */
+static inline int mat_write_bin(const char *path, uint32_t dtype,
+				size_t esize, int rows, int cols,
+				const void *data, int stride, int out_stride)
+{
+	struct mat_bin_header h = { .magic = MAT_BIN_MAGIC,
+				    .version = MAT_BIN_VERSION,
+				    .dtype = dtype,
+				    .rows = rows,
+				    .cols = cols,
+				    .stride = out_stride,
+				    .align = MATRIX_ALIGN,
+				    .offset = sizeof(h) };
+	char *pad = calloc(out_stride, esize);
+	FILE *f = fopen(path, "w");
+	bool ok = pad && f && fwrite(&h, sizeof(h), 1, f) == 1;
+
+	for (int i = 0; ok && i < rows; i++) {
+		memcpy(pad, (const char *)data + (size_t)i * stride * esize,
+		       cols * esize);
+		ok = fwrite(pad, esize, out_stride, f) == (size_t)out_stride;
+	}
+	if (f && fclose(f) != 0)
+		ok = false;
+	if (!ok)
+		fprintf(stderr, "%s: %s\n", path,
+			pad ? strerror(errno) : "out of memory");
+	free(pad);
+	return ok ? 0 : -1;
+}
+
+/* Write m as a binary matrix file, return 0, or -1 after printing why */
+static inline int mat_save_bin(const struct matrix *m, const char *path)
+{
+	int stride = (m->cols + MATRIX_ROW_INTS - 1) / MATRIX_ROW_INTS *
+		     MATRIX_ROW_INTS;
+	return mat_write_bin(path, MAT_INT32, sizeof(int), m->rows, m->cols,
+			     m->data, m->stride, stride);
+}
+
+static const char mat_digit_pairs[] = "00010203040506070809"
+				      "10111213141516171819"
+				      "20212223242526272829"
+				      "30313233343536373839"
+				      "40414243444546474849"
+				      "50515253545556575859"
+				      "60616263646566676869"
+				      "70717273747576777879"
+				      "80818283848586878889"
+				      "90919293949596979899";
+
+static inline int mat_uint_len(unsigned int u)
+{
+	int n = 1;
+	for (; u >= 10000; u /= 10000)
+		n += 4;
+	return n + (u >= 10) + (u >= 100) + (u >= 1000);
+}
+
+static inline int mat_int_len(int v)
+{
+	return v < 0 ? 1 + mat_uint_len(0u - v) : mat_uint_len(v);
+}
+
+/* Format v at p, two digits per step, return the end */
+static inline char *mat_itoa(char *p, int v)
+{
+	unsigned int u = v;
+	if (v < 0) {
+		*p++ = '-';
+		u = 0u - u;
+	}
+	char *end = p + mat_uint_len(u), *q = end;
+	for (; u >= 100; u /= 100) {
+		q -= 2;
+		memcpy(q, &mat_digit_pairs[u % 100 * 2], 2);
+	}
+	if (u >= 10)
+		memcpy(q - 2, &mat_digit_pairs[u * 2], 2);
+	else
+		q[-1] = '0' + u;
+	return end;
+}
+
+/*
+ * Length and text of a row as the lab programs print it: every number
+ * followed by a space, then a newline
+ */
+static inline size_t mat_row_len(const int *r, int n)
+{
+	size_t len = n + 1;
+	for (int j = 0; j < n; j++)
+		len += mat_int_len(r[j]);
+	return len;
+}
+
+static inline char *mat_format_row(char *p, const int *r, int n)
+{
+	for (int j = 0; j < n; j++) {
+		p = mat_itoa(p, r[j]);
+		*p++ = ' ';
+	}
+	*p++ = '\n';
+	return p;
+}
+
+#define MAT_WRITE_BLOCK (64 << 10) // bytes of text per block, about
+
+struct mat_write_job {
+	const struct matrix *m;
+	int fd;
+	int block_rows;
+	off_t *offset; // of every block, from the first row; one past the last
+	char **buf; // one per worker
+	atomic_int err; // errno of the first failed write
+};
+
+static void mat_measure_block(void *arg, int b, int worker)
+{
+	struct mat_write_job *job = (struct mat_write_job *)arg;
+	const struct matrix *m = job->m;
+	int r1 = (b + 1) * job->block_rows;
+	size_t len = 0;
+
+	for (int i = b * job->block_rows; i < r1 && i < m->rows; i++)
+		len += mat_row_len(mat_row(m, i), m->cols);
+	job->offset[b + 1] = len;
+}
+
+static void mat_write_block(void *arg, int b, int worker)
+{
+	struct mat_write_job *job = (struct mat_write_job *)arg;
+	const struct matrix *m = job->m;
+	int r1 = (b + 1) * job->block_rows;
+	char *p = job->buf[worker];
+
+	for (int i = b * job->block_rows; i < r1 && i < m->rows; i++)
+		p = mat_format_row(p, mat_row(m, i), m->cols);
+	size_t len = p - job->buf[worker], done = 0;
+	while (done < len && !atomic_load(&job->err)) {
+		ssize_t n = pwrite(job->fd, job->buf[worker] + done, len - done,
+				   job->offset[b] + done);
+		if (n < 0 && errno != EINTR)
+			atomic_store(&job->err, errno);
+		else if (n == 0) // no progress, would spin forever
+			atomic_store(&job->err, EIO);
+		if (n > 0)
+			done += n;
+	}
+}
+
+/*
+ * Append m to the file at path as the lab programs print it: a "rows
+ * cols" line, then one line per row. The rows are cut into blocks;
+ * nthreads workers first measure the text of every block, which gives
+ * each block its file offset, then format blocks into per-worker
+ * buffers with a fast itoa and write each with a single pwrite. The
+ * file is not opened O_APPEND (pwrite would ignore the offsets), its
+ * end is looked up once: do not append to it from elsewhere meanwhile.
+ * Return 0, or -1 after printing what is wrong.
+ */
+static inline int mat_append_text(const struct matrix *m, const char *path,
+				  int nthreads)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0666);
+	off_t base = fd < 0 ? -1 : lseek(fd, 0, SEEK_END);
+	if (base < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	char head[32];
+	int head_len = sprintf(head, "%d %d\n", m->rows, m->cols);
+	size_t row_max = (size_t)m->cols * 12 + 1; // "-2147483648 "
+	struct mat_write_job job = { .m = m, .fd = fd };
+	job.block_rows = MAT_WRITE_BLOCK / row_max;
+	if (job.block_rows < 1)
+		job.block_rows = 1;
+	int nblocks = (m->rows + job.block_rows - 1) / job.block_rows;
+	job.offset = calloc(nblocks + 1, sizeof(off_t));
+	job.buf = calloc(nthreads, sizeof(char *));
+	struct pool pool = { .nthreads = nthreads,
+			     .task = mat_measure_block,
+			     .arg = &job };
+	int ret = -1;
+	atomic_init(&job.err, 0);
+	if (job.offset == NULL || job.buf == NULL ||
+	    pool_run(&pool, nblocks) < 0)
+		goto nomem;
+	pool_free(&pool);
+
+	size_t block_max = 0;
+	job.offset[0] = base + head_len;
+	for (int b = 1; b <= nblocks; b++) {
+		size_t len = job.offset[b];
+		block_max = len > block_max ? len : block_max;
+		job.offset[b] = job.offset[b - 1] + len;
+	}
+	for (int t = 0; t < nthreads; t++)
+		if ((job.buf[t] = malloc(block_max ? block_max : 1)) == NULL)
+			goto nomem;
+
+	if (pwrite(fd, head, head_len, base) != head_len)
+		atomic_store(&job.err, errno ? errno : EIO);
+	pool.task = mat_write_block;
+	if (!atomic_load(&job.err) && pool_run(&pool, nblocks) < 0)
+		goto nomem;
+	int err = atomic_load(&job.err);
+	if (err)
+		fprintf(stderr, "%s: %s\n", path, strerror(err));
+	ret = err ? -1 : 0;
+	goto out;
+nomem:
+	fprintf(stderr, "%s: out of memory\n", path);
+out:
+	pool_free(&pool);
+	for (int t = 0; job.buf && t < nthreads; t++)
+		free(job.buf[t]);
+	free(job.buf);
+	free(job.offset);
+	if (close(fd) < 0 && ret == 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		ret = -1;
+	}
+	return ret;
+}
+
+/* Write m as text, the "rows cols" header then one row per line */
+static inline int mat_save_text(const struct matrix *m, const char *path)
+{
+	FILE *f = fopen(path, "w");
+	if (f == NULL) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	char *line = malloc((size_t)m->cols * 12 + 1);
+	fprintf(f, "%d %d\n", m->rows, m->cols);
+	for (int i = 0; line && i < m->rows; i++) {
+		char *end = mat_format_row(line, mat_row(m, i), m->cols);
+		// the input files have no space before the newline
+		end[-2] = '\n';
+		fwrite(line, 1, end - 1 - line, f);
+	}
+	bool bad = line == NULL || ferror(f);
+	bad |= fclose(f) != 0;
+	free(line);
+	if (bad) {
+		fprintf(stderr, "%s: write error\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+#endif
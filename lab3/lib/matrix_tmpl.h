@@ -0,0 +1,400 @@
+/*
+ * Matrix type template, included by matrix_types.h once per element
+ * type with
+ *
+ *   MAT_T      the element type
+ *   MAT_SFX    the suffix of every name: struct matrix_i64, gemm_i64...
+ *   MAT_DTYPE  its enum mat_dtype in binary files
+ *   MAT_FLOAT  1 for floating point types, 0 for integers (up to 64 bits)
+ *   MAT_FMT    printf format of one element in text files
+ *
+ * It generates the same matrix, I/O and blocked GEMM code as matrix.h,
+ * matrix_io.h and gemm.h do for int, with the micro-kernel written in
+ * plain C and compiled once per ISA of gemm_isas[]: the compiler
+ * vectorizes it for the element type. Everything is resolved at
+ * compile time, there is no per-element type dispatch.
+ *
+ * Rows are padded to a multiple of GEMM_NR elements (not just a cache
+ * line), so that a tile can always write whole NR-wide panels.
+ */
+
+#define MAT_FN(name) MAT_CAT(name, MAT_SFX)
+#define MAT_M MAT_FN(matrix)
+#define MAT_KC (GEMM_KC * (int)sizeof(int) / (int)sizeof(MAT_T))
+
+struct MAT_M {
+	int rows, cols;
+	int stride; // elements from one row to the next
+	MAT_T *data;
+	// data points into this mmapped file instead of the heap
+	void *map;
+	size_t map_len;
+};
+
+/* Return 0, or -1 when out of memory */
+static inline int MAT_FN(mat_alloc)(struct MAT_M *m, int rows, int cols)
+{
+	m->rows = rows;
+	m->cols = cols;
+	m->stride = (cols + GEMM_NR - 1) / GEMM_NR * GEMM_NR;
+	m->map = NULL;
+	m->map_len = 0;
+	size_t size = (size_t)rows * m->stride * sizeof(MAT_T);
+	m->data = aligned_alloc(MATRIX_ALIGN, size ? size : MATRIX_ALIGN);
+	if (m->data == NULL)
+		return -1;
+	memset(m->data, 0, size);
+	return 0;
+}
+
+static inline void MAT_FN(mat_free)(struct MAT_M *m)
+{
+	if (m->map)
+		munmap(m->map, m->map_len);
+	else
+		free(m->data);
+	m->data = NULL;
+	m->map = NULL;
+}
+
+static inline MAT_T *MAT_FN(mat_row)(const struct MAT_M *m, int i)
+{
+	return m->data + (size_t)i * m->stride;
+}
+
+/* *v = the number at p, return the end of it, or NULL if p has none */
+static inline const char *MAT_FN(mat_parse)(const char *p, const char *end,
+					    MAT_T *v)
+{
+#if MAT_FLOAT
+	double d;
+	if ((p = mat_double(p, end, &d)) != NULL)
+		*v = d;
+#else
+	int64_t n;
+	// and it has to fit
+	if ((p = mat_i64(p, end, &n)) != NULL && (MAT_T)n != n)
+		p = NULL;
+	if (p != NULL)
+		*v = n;
+#endif
+	return p;
+}
+
+static inline int MAT_FN(mat_load_text)(struct MAT_M *m, const char *path,
+					const char *p, const char *end,
+					int rows, int cols)
+{
+	int hr, hc;
+
+	madvise((void *)p, end - p, MADV_SEQUENTIAL);
+	if (mat_text_header(path, &p, end, &hr, &hc) < 0 ||
+	    mat_check_dims(path, hr, hc, rows, cols) < 0)
+		return -1;
+	if (MAT_FN(mat_alloc)(m, hr, hc) < 0) {
+		fprintf(stderr, "%s: out of memory\n", path);
+		return -1;
+	}
+	for (int i = 0; i < m->rows; i++) {
+		MAT_T *r = MAT_FN(mat_row)(m, i);
+		for (int j = 0; j < m->cols; j++) {
+			p = mat_skip(p, end, true);
+			if ((p = MAT_FN(mat_parse)(p, end, &r[j])) == NULL) {
+				fprintf(stderr,
+					"%s: bad or missing %s %d of %d\n",
+					path, mat_dtype_name(MAT_DTYPE),
+					i * m->cols + j + 1,
+					m->rows * m->cols);
+				MAT_FN(mat_free)(m);
+				return -1;
+			}
+		}
+	}
+	if (mat_skip(p, end, true) != end) {
+		fprintf(stderr, "%s: more than %d numbers\n", path,
+			m->rows * m->cols);
+		MAT_FN(mat_free)(m);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Read the matrix file at path, text or binary of this type, into m,
+ * like mat_load(). Return 0, or -1 after printing what is wrong.
+ */
+static inline int MAT_FN(mat_load)(struct MAT_M *m, const char *path,
+				   int rows, int cols)
+{
+	struct mat_bin_header h;
+	size_t size;
+	char *map = mat_map(path, &size);
+	if (map == NULL)
+		return -1;
+
+	int ret = 0;
+	if (!mat_is_bin(map, size)) {
+		ret = MAT_FN(mat_load_text)(m, path, map, map + size, rows,
+					    cols);
+	} else if (mat_bin_header(&h, path, map, size, MAT_DTYPE,
+				  sizeof(MAT_T), rows, cols) < 0) {
+		ret = -1;
+	} else if (h.offset % MATRIX_ALIGN == 0 && h.stride % GEMM_NR == 0) {
+		m->rows = h.rows;
+		m->cols = h.cols;
+		m->stride = h.stride;
+		m->data = (MAT_T *)(map + h.offset);
+		m->map = map;
+		m->map_len = size;
+		return 0; // m owns the mapping now
+	} else if (MAT_FN(mat_alloc)(m, h.rows, h.cols) < 0) {
+		fprintf(stderr, "%s: out of memory\n", path);
+		ret = -1;
+	} else {
+		for (int i = 0; i < m->rows; i++)
+			memcpy(MAT_FN(mat_row)(m, i),
+			       map + h.offset +
+				       (size_t)i * h.stride * sizeof(MAT_T),
+			       m->cols * sizeof(MAT_T));
+	}
+	munmap(map, size);
+	return ret;
+}
+
+static inline int MAT_FN(mat_save_bin)(const struct MAT_M *m,
+				       const char *path)
+{
+	return mat_write_bin(path, MAT_DTYPE, sizeof(MAT_T), m->rows, m->cols,
+			     m->data, m->stride, m->stride);
+}
+
+/* Write m as text, the "rows cols" header then one row per line */
+static inline int MAT_FN(mat_save_text)(const struct MAT_M *m,
+					const char *path)
+{
+	FILE *f = fopen(path, "w");
+	if (f == NULL) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	fprintf(f, "%d %d\n", m->rows, m->cols);
+	for (int i = 0; i < m->rows; i++) {
+		const MAT_T *r = MAT_FN(mat_row)(m, i);
+		for (int j = 0; j < m->cols; j++)
+			fprintf(f, j ? " " MAT_FMT : MAT_FMT, r[j]);
+		fputc('\n', f);
+	}
+	bool bad = ferror(f);
+	bad |= fclose(f) != 0;
+	if (bad) {
+		fprintf(stderr, "%s: write error\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+/* Text unless path ends in .bin */
+static inline int MAT_FN(mat_save)(const struct MAT_M *m, const char *path)
+{
+	return mat_path_is_bin(path) ? MAT_FN(mat_save_bin)(m, path) :
+				       MAT_FN(mat_save_text)(m, path);
+}
+
+/* c (MR x NR, row stride ldc) += a * bp, as gemm_kernel_scalar() */
+#define MAT_KERNEL(isa, attr)                                                 \
+	attr static void MAT_FN(gemm_kernel_##isa)(                           \
+		int kc, const MAT_T *const *a, const MAT_T *bp, MAT_T *c,     \
+		int ldc)                                                      \
+	{                                                                     \
+		MAT_T acc[GEMM_MR][GEMM_NR] = { 0 };                          \
+		for (int k = 0; k < kc; k++, bp += GEMM_NR)                   \
+			for (int r = 0; r < GEMM_MR; r++)                     \
+				for (int j = 0; j < GEMM_NR; j++)             \
+					acc[r][j] += a[r][k] * bp[j];         \
+		for (int r = 0; r < GEMM_MR; r++)                             \
+			for (int j = 0; j < GEMM_NR; j++)                     \
+				c[r * ldc + j] += acc[r][j];                  \
+	}
+
+MAT_KERNEL(scalar, )
+MAT_KERNEL(avx2, __attribute__((target("avx2"))))
+MAT_KERNEL(avx512, __attribute__((target("avx512f"))))
+
+#undef MAT_KERNEL
+
+// in the order of gemm_isas[]
+static void (*const MAT_FN(gemm_kernels)[])(int, const MAT_T *const *,
+					     const MAT_T *, MAT_T *, int) = {
+	MAT_FN(gemm_kernel_avx512),
+	MAT_FN(gemm_kernel_avx2),
+	MAT_FN(gemm_kernel_scalar),
+};
+
+_Static_assert(sizeof(MAT_FN(gemm_kernels)) / sizeof(void *) == GEMM_NUM_ISAS,
+	       "one kernel per ISA");
+
+/* bp = B[k0:k0+kc, j0:j0+nc] as NR-wide panels, zero padded */
+static inline void MAT_FN(gemm_pack_b)(MAT_T *bp, const struct MAT_M *b,
+				       int k0, int kc, int j0, int nc)
+{
+	for (int jp = 0; jp < nc; jp += GEMM_NR) {
+		int w = nc - jp < GEMM_NR ? nc - jp : GEMM_NR;
+		for (int k = 0; k < kc; k++, bp += GEMM_NR) {
+			const MAT_T *src =
+				MAT_FN(mat_row)(b, k0 + k) + j0 + jp;
+			memcpy(bp, src, w * sizeof(MAT_T));
+			memset(bp + w, 0, (GEMM_NR - w) * sizeof(MAT_T));
+		}
+	}
+}
+
+/* As gemm_block(), short tiles at the bottom go through a scratch tile */
+static inline void MAT_FN(gemm_block)(int isa, struct MAT_M *c,
+				      const struct MAT_M *a, const MAT_T *bp,
+				      int ic, int mc, int pc, int kc, int jc,
+				      int nc)
+{
+	MAT_T tile[GEMM_MR * GEMM_NR] __attribute__((aligned(MATRIX_ALIGN)));
+	const MAT_T *ap[GEMM_MR];
+
+	for (int jr = 0; jr < nc; jr += GEMM_NR) {
+		const MAT_T *panel = bp + (size_t)jr * kc;
+		for (int ir = 0; ir < mc; ir += GEMM_MR) {
+			int h = mc - ir < GEMM_MR ? mc - ir : GEMM_MR;
+			for (int r = 0; r < GEMM_MR; r++) {
+				int row = ic + ir + (r < h ? r : h - 1);
+				ap[r] = MAT_FN(mat_row)(a, row) + pc;
+			}
+			MAT_T *ct = MAT_FN(mat_row)(c, ic + ir) + jc + jr;
+			if (h == GEMM_MR) {
+				MAT_FN(gemm_kernels)[isa](kc, ap, panel, ct,
+							  c->stride);
+				continue;
+			}
+			memset(tile, 0, sizeof(tile));
+			MAT_FN(gemm_kernels)[isa](kc, ap, panel, tile, GEMM_NR);
+			for (int r = 0; r < h; r++, ct += c->stride)
+				for (int j = 0; j < GEMM_NR; j++)
+					ct[j] += tile[r * GEMM_NR + j];
+		}
+	}
+}
+
+/*
+ * C[r0:r1, c0:c1] += A[r0:r1, :] * B[:, c0:c1], like gemm_tile(). Return
+ * 0, or -1 when out of memory.
+ */
+static inline int MAT_FN(gemm_tile)(struct MAT_M *c, const struct MAT_M *a,
+				    const struct MAT_M *b, int r0, int r1,
+				    int c0, int c1)
+{
+	int isa = gemm_select() - gemm_isas;
+	int width = c1 - c0 < GEMM_NC ? c1 - c0 : GEMM_NC;
+	width = (width + GEMM_NR - 1) / GEMM_NR * GEMM_NR;
+	MAT_T *bp = aligned_alloc(MATRIX_ALIGN,
+				  (size_t)MAT_KC * (width ? width : GEMM_NR) *
+					  sizeof(MAT_T));
+	if (bp == NULL)
+		return -1;
+
+	for (int jc = c0; jc < c1; jc += GEMM_NC) {
+		int nc = c1 - jc < GEMM_NC ? c1 - jc : GEMM_NC;
+		for (int pc = 0; pc < a->cols; pc += MAT_KC) {
+			int kc = a->cols - pc < MAT_KC ? a->cols - pc : MAT_KC;
+			MAT_FN(gemm_pack_b)(bp, b, pc, kc, jc, nc);
+			for (int ic = r0; ic < r1; ic += GEMM_MC) {
+				int mc = r1 - ic < GEMM_MC ? r1 - ic : GEMM_MC;
+				MAT_FN(gemm_block)(isa, c, a, bp, ic, mc, pc,
+						   kc, jc, nc);
+			}
+		}
+	}
+	free(bp);
+	return 0;
+}
+
+struct MAT_FN(gemm_job) {
+	struct MAT_M *c;
+	const struct MAT_M *a, *b;
+	atomic_int err;
+};
+
+// rows task * GEMM_MC.. of C
+static void MAT_FN(gemm_task)(void *arg, int task, int worker)
+{
+	struct MAT_FN(gemm_job) *job = (struct MAT_FN(gemm_job) *)arg;
+	int r0 = task * GEMM_MC;
+	int r1 = r0 + GEMM_MC < job->a->rows ? r0 + GEMM_MC : job->a->rows;
+
+	if (MAT_FN(gemm_tile)(job->c, job->a, job->b, r0, r1, 0,
+			      job->b->cols) < 0)
+		atomic_store(&job->err, 1);
+}
+
+/* C += A * B on nthreads threads, return 0, or -1 when out of memory */
+static inline int MAT_FN(gemm)(struct MAT_M *c, const struct MAT_M *a,
+			       const struct MAT_M *b, int nthreads)
+{
+	struct MAT_FN(gemm_job) job = { .c = c, .a = a, .b = b };
+	struct pool pool = { .nthreads = nthreads,
+			     .task = MAT_FN(gemm_task),
+			     .arg = &job };
+
+	gemm_select();
+	atomic_init(&job.err, 0);
+	int ret = pool_run(&pool, (a->rows + GEMM_MC - 1) / GEMM_MC);
+	pool_free(&pool);
+	return ret < 0 || atomic_load(&job.err) ? -1 : 0;
+}
+
+/*
+ * out = the product of the matrix files a_path and b_path, with
+ * elements of this type. Return 0, or -1 after printing what is wrong.
+ */
+static inline int MAT_FN(matmul)(const char *a_path, const char *b_path,
+				 const char *out, int nthreads)
+{
+	struct MAT_M a, b, c;
+	int ret = -1;
+
+	if (MAT_FN(mat_load)(&a, a_path, 0, 0) < 0)
+		return -1;
+	if (MAT_FN(mat_load)(&b, b_path, a.cols, 0) < 0)
+		goto free_a;
+	if (MAT_FN(mat_alloc)(&c, a.rows, b.cols) < 0) {
+		fprintf(stderr, "%s: out of memory\n", out);
+		goto free_b;
+	}
+	if (MAT_FN(gemm)(&c, &a, &b, nthreads) < 0)
+		fprintf(stderr, "%s: out of memory\n", out);
+	else
+		ret = MAT_FN(mat_save)(&c, out);
+	MAT_FN(mat_free)(&c);
+free_b:
+	MAT_FN(mat_free)(&b);
+free_a:
+	MAT_FN(mat_free)(&a);
+	return ret;
+}
+
+/* Read the matrix file in and write it to out as binary or as text */
+static inline int MAT_FN(mat_convert)(const char *in, const char *out,
+				      bool bin)
+{
+	struct MAT_M m;
+	if (MAT_FN(mat_load)(&m, in, 0, 0) < 0)
+		return -1;
+	int ret = bin ? MAT_FN(mat_save_bin)(&m, out) :
+			MAT_FN(mat_save_text)(&m, out);
+	MAT_FN(mat_free)(&m);
+	return ret;
+}
+
+#undef MAT_FN
+#undef MAT_M
+#undef MAT_KC
+#undef MAT_T
+#undef MAT_SFX
+#undef MAT_DTYPE
+#undef MAT_FLOAT
+#undef MAT_FMT
@@ -0,0 +1,204 @@
+#ifndef MATRIX_TYPES_H
+#define MATRIX_TYPES_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include "matrix.h"
+#include "matrix_io.h"
+#include "gemm.h"
+#include "pool.h"
+
+/*
+ * Matrices of int64, float and double next to the int ones
+ *
+ * matrix_tmpl.h is instantiated once per type: struct matrix_i64 with
+ * mat_load_i64(), gemm_i64(), matmul_i64()... and the same for f32 and
+ * f64. int32 is struct matrix itself, with its parallel parser, writer
+ * and hand-written kernels. matmul() and mat_convert() pick the type
+ * once, from a dtype known at run time, and run the code specialized
+ * for it.
+ */
+
+#define MAT_CAT_(a, b) a##_##b
+#define MAT_CAT(a, b) MAT_CAT_(a, b)
+
+/* *v = the integer at p, like mat_int() but 64 bits wide */
+static inline const char *mat_i64(const char *p, const char *end, int64_t *v)
+{
+	bool neg = false;
+	uint64_t n = 0;
+
+	if (p < end && (*p == '-' || *p == '+'))
+		neg = *p++ == '-';
+	if (p == end || (unsigned)(*p - '0') > 9)
+		return NULL;
+	do {
+		unsigned d = *p++ - '0';
+		if (n > (UINT64_MAX - d) / 10)
+			return NULL;
+		n = n * 10 + d;
+	} while (p < end && (unsigned)(*p - '0') <= 9);
+	if (n > (uint64_t)INT64_MAX + neg)
+		return NULL;
+	if (p < end && !mat_blank(*p) && *p != '\n')
+		return NULL;
+	*v = neg ? (int64_t)(0 - n) : (int64_t)n;
+	return p;
+}
+
+/* *v = the floating point number at p, as strtod() reads it */
+static inline const char *mat_double(const char *p, const char *end,
+				     double *v)
+{
+	char buf[64], *e;
+	size_t n = 0;
+
+	// the mapping does not end in a NUL, strtod() gets a copy
+	while (p + n < end && n < sizeof(buf) && !mat_blank(p[n]) &&
+	       p[n] != '\n')
+		n++;
+	if (n == 0 || n == sizeof(buf))
+		return NULL;
+	memcpy(buf, p, n);
+	buf[n] = '\0';
+	*v = strtod(buf, &e);
+	return e == buf + n ? p + n : NULL;
+}
+
+static inline bool mat_path_is_bin(const char *path)
+{
+	size_t len = strlen(path);
+	return len >= 4 && !strcmp(path + len - 4, ".bin");
+}
+
+#define MAT_T int64_t
+#define MAT_SFX i64
+#define MAT_DTYPE MAT_INT64
+#define MAT_FLOAT 0
+#define MAT_FMT "%" PRId64
+#include "matrix_tmpl.h"
+
+#define MAT_T float
+#define MAT_SFX f32
+#define MAT_DTYPE MAT_FLOAT32
+#define MAT_FLOAT 1
+#define MAT_FMT "%.9g" // enough digits to read back the same float
+#include "matrix_tmpl.h"
+
+#define MAT_T double
+#define MAT_SFX f64
+#define MAT_DTYPE MAT_FLOAT64
+#define MAT_FLOAT 1
+#define MAT_FMT "%.17g"
+#include "matrix_tmpl.h"
+
+struct matmul_i32_job {
+	struct matrix *c;
+	const struct matrix *a, *b;
+	atomic_int err;
+};
+
+static void matmul_i32_task(void *arg, int task, int worker)
+{
+	struct matmul_i32_job *job = (struct matmul_i32_job *)arg;
+	int r0 = task * GEMM_MC;
+	int r1 = r0 + GEMM_MC < job->a->rows ? r0 + GEMM_MC : job->a->rows;
+
+	if (gemm_rows(job->c, job->a, job->b, r0, r1) < 0)
+		atomic_store(&job->err, 1);
+}
+
+/* matmul_i64() and friends for int: struct matrix and gemm.h */
+static inline int matmul_i32(const char *a_path, const char *b_path,
+			     const char *out, int nthreads)
+{
+	struct matrix a, b, c;
+	struct matmul_i32_job job = { .c = &c, .a = &a, .b = &b };
+	struct pool pool = { .nthreads = nthreads,
+			     .task = matmul_i32_task,
+			     .arg = &job };
+	int ret = -1;
+
+	if (mat_load(&a, a_path, 0, 0) < 0)
+		return -1;
+	if (mat_load(&b, b_path, a.cols, 0) < 0)
+		goto free_a;
+	if (mat_alloc(&c, a.rows, b.cols) < 0) {
+		fprintf(stderr, "%s: out of memory\n", out);
+		goto free_b;
+	}
+	gemm_select();
+	atomic_init(&job.err, 0);
+	if (pool_run(&pool, (a.rows + GEMM_MC - 1) / GEMM_MC) < 0 ||
+	    atomic_load(&job.err))
+		fprintf(stderr, "%s: out of memory\n", out);
+	else if (mat_path_is_bin(out))
+		ret = mat_save_bin(&c, out);
+	else
+		ret = mat_save_text(&c, out);
+	pool_free(&pool);
+	mat_free(&c);
+free_b:
+	mat_free(&b);
+free_a:
+	mat_free(&a);
+	return ret;
+}
+
+static inline int mat_convert_i32(const char *in, const char *out, bool bin)
+{
+	struct matrix m;
+	if (mat_load(&m, in, 0, 0) < 0)
+		return -1;
+	int ret = bin ? mat_save_bin(&m, out) : mat_save_text(&m, out);
+	mat_free(&m);
+	return ret;
+}
+
+/*
+ * out = a * b for the matrix files a_path and b_path, read and
+ * multiplied as dtype, on nthreads threads. out is binary if its name
+ * ends in .bin, text otherwise. Return 0, or -1 after printing what is
+ * wrong.
+ */
+static inline int matmul(int dtype, const char *a_path, const char *b_path,
+			 const char *out, int nthreads)
+{
+	switch (dtype) {
+	case MAT_INT32:
+		return matmul_i32(a_path, b_path, out, nthreads);
+	case MAT_INT64:
+		return matmul_i64(a_path, b_path, out, nthreads);
+	case MAT_FLOAT32:
+		return matmul_f32(a_path, b_path, out, nthreads);
+	case MAT_FLOAT64:
+		return matmul_f64(a_path, b_path, out, nthreads);
+	}
+	fprintf(stderr, "unknown matrix type %d\n", dtype);
+	return -1;
+}
+
+/* Read in as dtype and write it to out as binary or as text */
+static inline int mat_convert(int dtype, const char *in, const char *out,
+			      bool bin)
+{
+	switch (dtype) {
+	case MAT_INT32:
+		return mat_convert_i32(in, out, bin);
+	case MAT_INT64:
+		return mat_convert_i64(in, out, bin);
+	case MAT_FLOAT32:
+		return mat_convert_f32(in, out, bin);
+	case MAT_FLOAT64:
+		return mat_convert_f64(in, out, bin);
+	}
+	fprintf(stderr, "unknown matrix type %d\n", dtype);
+	return -1;
+}
+
+#endif
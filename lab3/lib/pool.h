@@ -0,0 +1,219 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Work-stealing thread pool for a fixed set of independent tasks
+ *
+ * pool_run() deals tasks 0..ntasks-1 out in contiguous runs, one run
+ * per worker deque, then starts the workers. A worker pops its own
+ * deque from the bottom and, once it is empty, steals from the top of
+ * the others' (Chase-Lev). Nothing is pushed after the start, so the
+ * deque arrays are read-only while the workers run and a worker is
+ * done when a full pass over all deques finds nothing left.
+ */
+
+#define POOL_EMPTY -1
+#define POOL_ABORT -2 // lost a race, try again
+
+struct pool_deque {
+	atomic_long top; // next to steal
+	char pad[64 - sizeof(atomic_long)];
+	atomic_long bottom; // one past the owner's next pop
+	int *tasks;
+};
+
+struct pool;
+
+struct pool_worker {
+	struct pool *pool;
+	pthread_t tid;
+	int id;
+	unsigned int seed;
+	struct pool_deque dq;
+	long tasks, steals;
+	double busy; // seconds spent in tasks
+} __attribute__((aligned(64)));
+
+struct pool {
+	int nthreads;
+	void (*task)(void *arg, int task, int worker);
+	// optional, in every worker thread after its last task
+	void (*done)(void *arg, int worker);
+	void *arg;
+	struct pool_worker *w;
+	double wall; // seconds of the last pool_run()
+};
+
+static inline double pool_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline int pool_default_threads()
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? n : 1;
+}
+
+static inline int pool_pop(struct pool_deque *d)
+{
+	long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+	atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	long t = atomic_load_explicit(&d->top, memory_order_relaxed);
+	if (t > b) {
+		atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+		return POOL_EMPTY;
+	}
+	int task = d->tasks[b];
+	if (t == b) {
+		// last one, race the thieves for it
+		if (!atomic_compare_exchange_strong_explicit(
+			    &d->top, &t, t + 1, memory_order_seq_cst,
+			    memory_order_relaxed))
+			task = POOL_EMPTY;
+		atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+	}
+	return task;
+}
+
+static inline int pool_steal(struct pool_deque *d)
+{
+	long t = atomic_load_explicit(&d->top, memory_order_acquire);
+	atomic_thread_fence(memory_order_seq_cst);
+	long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+	if (t >= b)
+		return POOL_EMPTY;
+	int task = d->tasks[t];
+	if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+						     memory_order_seq_cst,
+						     memory_order_relaxed))
+		return POOL_ABORT;
+	return task;
+}
+
+// a task from some other deque, POOL_EMPTY when they are all empty
+static inline int pool_steal_any(struct pool_worker *w)
+{
+	struct pool *p = w->pool;
+	for (;;) {
+		bool raced = false;
+		int start = rand_r(&w->seed) % p->nthreads;
+		for (int i = 0; i < p->nthreads; i++) {
+			int v = (start + i) % p->nthreads;
+			if (v == w->id)
+				continue;
+			int task = pool_steal(&p->w[v].dq);
+			if (task >= 0)
+				return task;
+			raced |= task == POOL_ABORT;
+		}
+		if (!raced)
+			return POOL_EMPTY;
+	}
+}
+
+static void *pool_worker_main(void *arg)
+{
+	struct pool_worker *w = (struct pool_worker *)arg;
+	struct pool *p = w->pool;
+	int task;
+
+	for (;;) {
+		task = pool_pop(&w->dq);
+		if (task == POOL_EMPTY) {
+			task = pool_steal_any(w);
+			if (task == POOL_EMPTY)
+				break;
+			++w->steals;
+		}
+		double t = pool_now();
+		p->task(p->arg, task, w->id);
+		w->busy += pool_now() - t;
+		++w->tasks;
+	}
+	if (p->done)
+		p->done(p->arg, w->id);
+	return NULL;
+}
+
+/*
+ * Run p->task for every task on p->nthreads threads, return 0, or -1
+ * when out of memory. If some threads cannot be created the others
+ * steal their tasks. The per-worker counters stay in p->w until
+ * pool_free().
+ */
+static inline int pool_run(struct pool *p, int ntasks)
+{
+	size_t size = p->nthreads * sizeof(struct pool_worker);
+	p->w = aligned_alloc(64, size);
+	int *tasks = malloc((ntasks ? ntasks : 1) * sizeof(int));
+	if (p->w == NULL || tasks == NULL) {
+		free(tasks);
+		return -1;
+	}
+	memset(p->w, 0, size);
+	for (int i = 0; i < ntasks; i++)
+		tasks[i] = i;
+
+	for (int i = 0; i < p->nthreads; i++) {
+		struct pool_worker *w = &p->w[i];
+		w->pool = p;
+		w->id = i;
+		w->seed = i + 1;
+		// popped from the bottom: worker i starts at the end of its run
+		w->dq.tasks = tasks;
+		atomic_init(&w->dq.top, (long)ntasks * i / p->nthreads);
+		atomic_init(&w->dq.bottom, (long)ntasks * (i + 1) / p->nthreads);
+	}
+
+	int started = 0;
+	double t = pool_now();
+	for (; started < p->nthreads; started++)
+		if (pthread_create(&p->w[started].tid, NULL, pool_worker_main,
+				   &p->w[started]) != 0)
+			break;
+	if (started == 0)
+		pool_worker_main(&p->w[0]);
+	for (int i = 0; i < started; i++)
+		pthread_join(p->w[i].tid, NULL);
+	p->wall = pool_now() - t;
+	free(tasks);
+	return 0;
+}
+
+static inline void pool_free(struct pool *p)
+{
+	free(p->w);
+	p->w = NULL;
+}
+
+/* One line per worker: tasks, steals and busy time against wall time */
+static inline void pool_report(FILE *out, const struct pool *p)
+{
+	double busy = 0;
+	for (int i = 0; i < p->nthreads; i++) {
+		const struct pool_worker *w = &p->w[i];
+		busy += w->busy;
+		fprintf(out,
+			"worker %d: %ld tasks, %ld stolen, busy %.2f ms (%.0f%%)\n",
+			i, w->tasks, w->steals, w->busy * 1e3,
+			p->wall > 0 ? w->busy / p->wall * 100 : 0);
+	}
+	fprintf(out, "%d workers, wall %.2f ms, utilisation %.0f%%\n",
+		p->nthreads, p->wall * 1e3,
+		p->wall > 0 ? busy / (p->wall * p->nthreads) * 100 : 0);
+}
+
+#endif
@@ -0,0 +1,343 @@
+#ifndef STRASSEN_H
+#define STRASSEN_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "matrix.h"
+#include "gemm.h"
+
+/*
+ * Strassen-Winograd multiplication on top of the blocked GEMM: C += A * B
+ *
+ * A level splits A, B and C into 2x2 blocks and forms C from 7 block
+ * products and 15 block additions instead of 8 products (Winograd's
+ * variant of Strassen). Blocks are split while all three dimensions
+ * are above the cutoff; at or below it the gemm.h kernel runs, which
+ * beats the extra additions on small blocks.
+ *
+ * The operands are zero padded once, so that every block on every
+ * level splits evenly into halves that are multiples of GEMM_NR wide.
+ * Sums wrap modulo 2^32 like the kernel's products, so the result is
+ * exactly the int32 result of the classical product.
+ *
+ * The top level is 7 independent tasks, one per product, to run on a
+ * pool (pool.h) or in a loop. Each task recurses on its own, with two
+ * temporaries per level. All the temporaries are cut out of one
+ * allocation made up front, nothing is allocated or zeroed on the way
+ * down.
+ */
+
+#define STRASSEN_CUTOFF 512 // default: blocks up to this size go to gemm
+
+struct strassen {
+	const struct gemm_isa *isa;
+	int cutoff;
+	struct matrix *out;
+	int split; // 0: too small, a single gemm task
+	int padded; // a and b are copies, not views of the operands
+	struct matrix a, b;
+	struct matrix aq[4], bq[4]; // blocks 11, 12, 21, 22 of a and b
+	struct matrix s[4], t[4]; // S1..S4 of A's blocks, T1..T4 of B's
+	struct matrix p[7]; // the products P1..P7
+	const struct matrix *pa[7], *pb[7]; // their operands
+	int *ws; // s, t, p and the tasks' temporaries
+	size_t task_ws; // ints of temporaries per task
+	atomic_int err;
+};
+
+// c = a + b and c = a - b; c may be a or b
+static inline void strassen_add(struct matrix *c, const struct matrix *a,
+				const struct matrix *b)
+{
+	for (int i = 0; i < c->rows; i++) {
+		unsigned *r = (unsigned *)mat_row(c, i);
+		const unsigned *x = (const unsigned *)mat_row(a, i);
+		const unsigned *y = (const unsigned *)mat_row(b, i);
+		for (int j = 0; j < c->cols; j++)
+			r[j] = x[j] + y[j];
+	}
+}
+
+static inline void strassen_sub(struct matrix *c, const struct matrix *a,
+				const struct matrix *b)
+{
+	for (int i = 0; i < c->rows; i++) {
+		unsigned *r = (unsigned *)mat_row(c, i);
+		const unsigned *x = (const unsigned *)mat_row(a, i);
+		const unsigned *y = (const unsigned *)mat_row(b, i);
+		for (int j = 0; j < c->cols; j++)
+			r[j] = x[j] - y[j];
+	}
+}
+
+// q[0..3] = blocks 11, 12, 21, 22 of m
+static inline void strassen_quarters(struct matrix q[4], const struct matrix *m)
+{
+	int h = m->rows / 2, w = m->cols / 2;
+	mat_view(&q[0], m, 0, 0, h, w);
+	mat_view(&q[1], m, 0, w, h, w);
+	mat_view(&q[2], m, h, 0, h, w);
+	mat_view(&q[3], m, h, w, h, w);
+}
+
+static inline int strassen_splits(int m, int k, int n, int cutoff)
+{
+	return m > cutoff && k > cutoff && n > cutoff &&
+	       (m | k | n) % (2 * GEMM_NR) == 0;
+}
+
+// ints of temporaries for strassen_mul() of an m x k by k x n product
+static inline size_t strassen_ws(int m, int k, int n, int cutoff)
+{
+	if (!strassen_splits(m, k, n, cutoff))
+		return 0;
+	return (size_t)m / 2 * (k > n ? k / 2 : n / 2) + (size_t)k / 2 * n / 2 +
+	       strassen_ws(m / 2, k / 2, n / 2, cutoff);
+}
+
+/*
+ * v = a rows x cols matrix at *ws, which moves past it. cols is a
+ * multiple of GEMM_NR, so rows stay cache line aligned.
+ */
+static inline void strassen_carve(struct matrix *v, int **ws, int rows,
+				  int cols)
+{
+	v->rows = rows;
+	v->cols = cols;
+	v->stride = cols;
+	v->data = *ws;
+	v->map = NULL;
+	v->map_len = 0;
+	*ws += (size_t)rows * cols;
+}
+
+/*
+ * C = A * B on this thread. Overwrites C, using the schedule of Boyer,
+ * Dumas, Pernet and Zhou that needs only two temporaries: the products
+ * are built up in the blocks of C themselves. Return 0, or -1 when out
+ * of memory.
+ */
+static int strassen_mul(const struct gemm_isa *isa, struct matrix *c,
+			const struct matrix *a, const struct matrix *b,
+			int cutoff, int *ws)
+{
+	int m = a->rows, k = a->cols, n = b->cols;
+	if (!strassen_splits(m, k, n, cutoff)) {
+		for (int i = 0; i < m; i++)
+			memset(mat_row(c, i), 0, n * sizeof(int));
+		return gemm_tile_isa(isa, c, a, b, 0, m, 0, n);
+	}
+
+	struct matrix A[4], B[4], C[4], x, y, X;
+	strassen_carve(&x, &ws, m / 2, k > n ? k / 2 : n / 2);
+	strassen_carve(&y, &ws, k / 2, n / 2);
+	strassen_quarters(A, a);
+	strassen_quarters(B, b);
+	strassen_quarters(C, c);
+	mat_view(&X, &x, 0, 0, m / 2, k / 2);
+
+	int err = 0;
+	// C21 = P7 = S3 T3, C22 = P5 = S1 T1, C12 = P6 = S2 T2
+	strassen_sub(&X, &A[0], &A[2]);
+	strassen_sub(&y, &B[3], &B[1]);
+	err |= strassen_mul(isa, &C[2], &X, &y, cutoff, ws);
+	strassen_add(&X, &A[2], &A[3]);
+	strassen_sub(&y, &B[1], &B[0]);
+	err |= strassen_mul(isa, &C[3], &X, &y, cutoff, ws);
+	strassen_sub(&X, &X, &A[0]);
+	strassen_sub(&y, &B[3], &y);
+	err |= strassen_mul(isa, &C[1], &X, &y, cutoff, ws);
+	// C11 = P3 = S4 B22
+	strassen_sub(&X, &A[1], &X);
+	err |= strassen_mul(isa, &C[0], &X, &B[3], cutoff, ws);
+
+	mat_view(&X, &x, 0, 0, m / 2, n / 2);
+	err |= strassen_mul(isa, &X, &A[0], &B[0], cutoff, ws); // X = P1
+	strassen_add(&C[1], &X, &C[1]); // C12 = U2 = P1 + P6
+	strassen_add(&C[2], &C[1], &C[2]); // C21 = U3 = U2 + P7
+	strassen_add(&C[1], &C[1], &C[3]); // C12 = U4 = U2 + P5
+	strassen_add(&C[3], &C[2], &C[3]); // C22 = U3 + P5, done
+	strassen_add(&C[1], &C[1], &C[0]); // C12 = U4 + P3, done
+	// C11 = P4 = A22 T4, then C21 = U3 - P4 is done
+	strassen_sub(&y, &y, &B[2]);
+	err |= strassen_mul(isa, &C[0], &A[3], &y, cutoff, ws);
+	strassen_sub(&C[2], &C[2], &C[0]);
+	// C11 = P2 = A12 B21, then C11 = P1 + P2 is done
+	err |= strassen_mul(isa, &C[0], &A[1], &B[2], cutoff, ws);
+	strassen_add(&C[0], &X, &C[0]);
+	return err ? -1 : 0;
+}
+
+// zero padded copy of m
+static inline int strassen_pad(struct matrix *p, const struct matrix *m,
+			       int rows, int cols)
+{
+	if (mat_alloc(p, rows, cols) < 0)
+		return -1;
+	for (int i = 0; i < m->rows; i++)
+		memcpy(mat_row(p, i), mat_row(m, i), m->cols * sizeof(int));
+	return 0;
+}
+
+static inline void strassen_free(struct strassen *s)
+{
+	if (s->padded) {
+		mat_free(&s->a);
+		mat_free(&s->b);
+	}
+	free(s->ws);
+}
+
+/*
+ * Prepare C += A * B with blocks of at most cutoff going to gemm. Return
+ * the number of tasks to run strassen_task() for, 7 or 1 when the
+ * product is too small to split, or -1 when out of memory. s must stay
+ * where it is until strassen_finish(). Call it before any threads use
+ * gemm, like gemm_select().
+ */
+static inline int strassen_init(struct strassen *s, struct matrix *c,
+				const struct matrix *a,
+				const struct matrix *b, int cutoff)
+{
+	int m = a->rows, k = a->cols, n = b->cols;
+	int min = m < k ? m : k, depth = 0;
+	min = min < n ? min : n;
+
+	memset(s, 0, sizeof(*s));
+	s->isa = gemm_select();
+	s->cutoff = cutoff;
+	s->out = c;
+	atomic_init(&s->err, 0);
+	while ((min >> depth) > cutoff)
+		depth++;
+	if (depth == 0) {
+		s->pa[0] = a;
+		s->pb[0] = b;
+		return 1;
+	}
+
+	int unit = GEMM_NR << depth;
+	m = (m + unit - 1) / unit * unit;
+	k = (k + unit - 1) / unit * unit;
+	n = (n + unit - 1) / unit * unit;
+	s->split = 1;
+	s->padded = m != a->rows || k != a->cols || n != b->cols;
+	if (!s->padded) {
+		mat_view(&s->a, a, 0, 0, m, k);
+		mat_view(&s->b, b, 0, 0, k, n);
+	} else if (strassen_pad(&s->a, a, m, k) < 0 ||
+		   strassen_pad(&s->b, b, k, n) < 0) {
+		goto oom;
+	}
+	s->task_ws = strassen_ws(m / 2, k / 2, n / 2, cutoff);
+	size_t ws = 4 * ((size_t)m / 2 * k / 2 + (size_t)k / 2 * n / 2) +
+		    7 * ((size_t)m / 2 * n / 2 + s->task_ws);
+	int *p = s->ws = aligned_alloc(MATRIX_ALIGN, ws * sizeof(int));
+	if (p == NULL)
+		goto oom;
+	for (int i = 0; i < 4; i++) {
+		strassen_carve(&s->s[i], &p, m / 2, k / 2);
+		strassen_carve(&s->t[i], &p, k / 2, n / 2);
+	}
+	for (int i = 0; i < 7; i++)
+		strassen_carve(&s->p[i], &p, m / 2, n / 2);
+
+	struct matrix *A = s->aq, *B = s->bq, *S = s->s, *T = s->t;
+	strassen_quarters(A, &s->a);
+	strassen_quarters(B, &s->b);
+	strassen_add(&S[0], &A[2], &A[3]); // S1 = A21 + A22
+	strassen_sub(&S[1], &S[0], &A[0]); // S2 = S1 - A11
+	strassen_sub(&S[2], &A[0], &A[2]); // S3 = A11 - A21
+	strassen_sub(&S[3], &A[1], &S[1]); // S4 = A12 - S2
+	strassen_sub(&T[0], &B[1], &B[0]); // T1 = B12 - B11
+	strassen_sub(&T[1], &B[3], &T[0]); // T2 = B22 - T1
+	strassen_sub(&T[2], &B[3], &B[1]); // T3 = B22 - B12
+	strassen_sub(&T[3], &T[1], &B[2]); // T4 = T2 - B21
+
+	const struct matrix *pa[7] = { &A[0], &A[1], &S[3], &A[3],
+				       &S[0], &S[1], &S[2] };
+	const struct matrix *pb[7] = { &B[0], &B[2], &B[3], &T[3],
+				       &T[0], &T[1], &T[2] };
+	memcpy(s->pa, pa, sizeof(pa));
+	memcpy(s->pb, pb, sizeof(pb));
+	return 7;
+oom:
+	strassen_free(s);
+	return -1;
+}
+
+/* Task i computes P(i+1), or the whole product when it is not split */
+static void strassen_task(void *arg, int task, int worker)
+{
+	struct strassen *s = (struct strassen *)arg;
+	int err;
+
+	if (s->split)
+		err = strassen_mul(s->isa, &s->p[task], s->pa[task],
+				   s->pb[task], s->cutoff,
+				   s->p[6].data + s->p[6].rows * s->p[6].cols +
+					   task * s->task_ws);
+	else
+		err = gemm_tile_isa(s->isa, s->out, s->pa[0], s->pb[0], 0,
+				    s->pa[0]->rows, 0, s->pb[0]->cols);
+	if (err < 0)
+		atomic_store(&s->err, 1);
+}
+
+// C[r0:, c0:] += p, as far as C goes: p may run into the padding
+static inline void strassen_acc(struct matrix *c, int r0, int c0,
+				const struct matrix *p)
+{
+	struct matrix v;
+	int rows = c->rows - r0 < p->rows ? c->rows - r0 : p->rows;
+	int cols = c->cols - c0 < p->cols ? c->cols - c0 : p->cols;
+	if (rows <= 0 || cols <= 0)
+		return;
+	mat_view(&v, c, r0, c0, rows, cols);
+	strassen_add(&v, &v, p);
+}
+
+/*
+ * After all the tasks: add the products up into C and free s. Return
+ * 0, or -1 when a task ran out of memory.
+ */
+static inline int strassen_finish(struct strassen *s)
+{
+	struct matrix *P = s->p;
+	int err = atomic_load(&s->err);
+	int h = s->a.rows / 2, w = s->b.cols / 2;
+
+	if (!s->split || err)
+		goto out;
+	// in place in the products, each is last used here
+	strassen_add(&P[1], &P[0], &P[1]); // C11 = P1 + P2
+	strassen_add(&P[5], &P[0], &P[5]); // U2 = P1 + P6
+	strassen_add(&P[6], &P[5], &P[6]); // U3 = U2 + P7
+	strassen_add(&P[5], &P[5], &P[4]); // U4 = U2 + P5
+	strassen_add(&P[5], &P[5], &P[2]); // C12 = U4 + P3
+	strassen_add(&P[4], &P[6], &P[4]); // C22 = U3 + P5
+	strassen_sub(&P[6], &P[6], &P[3]); // C21 = U3 - P4
+	strassen_acc(s->out, 0, 0, &P[1]);
+	strassen_acc(s->out, 0, w, &P[5]);
+	strassen_acc(s->out, h, 0, &P[6]);
+	strassen_acc(s->out, h, w, &P[4]);
+out:
+	strassen_free(s);
+	return err ? -1 : 0;
+}
+
+/* C += A * B on this thread, return 0, or -1 when out of memory */
+static inline int strassen(struct matrix *c, const struct matrix *a,
+			  const struct matrix *b, int cutoff)
+{
+	struct strassen s;
+	int tasks = strassen_init(&s, c, a, b, cutoff);
+	if (tasks < 0)
+		return -1;
+	for (int i = 0; i < tasks; i++)
+		strassen_task(&s, i, 0);
+	return strassen_finish(&s);
+}
+
+#endif
@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "strassen.h"
+
+/*
+ * Strassen-Winograd check and benchmark
+ *
+ * strassen() is compared with the classical gemm() on odd and
+ * rectangular shapes, with cutoffs small enough to recurse several
+ * levels and with values big enough for the products to overflow:
+ * both have to agree bit for bit. Then both are timed on square
+ * products of growing size and on the 1234x250 by 250x1234 product
+ * of 3_2.c, for a few cutoffs.
+ *
+ * usage: strassen_bench [runs] [max size]
+ */
+
+static const int cutoffs[] = { 128, 256, 512, 1024 };
+#define NUM_CUTOFFS (int)(sizeof(cutoffs) / sizeof(cutoffs[0]))
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fill(struct matrix *m, int rows, int cols, int range)
+{
+	if (mat_alloc(m, rows, cols) < 0) {
+		printf("Out of memory\n");
+		exit(1);
+	}
+	for (int i = 0; i < rows; i++)
+		for (int j = 0; j < cols; j++)
+			MAT(m, i, j) = range ? rand() % (2 * range + 1) - range :
+					       (int)((unsigned)rand() << 1);
+}
+
+// return the number of wrong rows
+static int check(int m, int k, int n, int cutoff, int range)
+{
+	struct matrix a, b, want, got;
+	int bad = 0;
+
+	fill(&a, m, k, range);
+	fill(&b, k, n, range);
+	fill(&want, m, n, 1000); // C += A * B: start from the same non-zero C
+	mat_alloc(&got, m, n);
+	for (int i = 0; i < m; i++)
+		memcpy(mat_row(&got, i), mat_row(&want, i), n * sizeof(int));
+	gemm(&want, &a, &b);
+	if (strassen(&got, &a, &b, cutoff) < 0)
+		bad = m;
+	for (int i = 0; i < m && !bad; i++)
+		bad += memcmp(mat_row(&got, i), mat_row(&want, i),
+			      n * sizeof(int)) != 0;
+	mat_free(&a);
+	mat_free(&b);
+	mat_free(&want);
+	mat_free(&got);
+	return bad;
+}
+
+// cutoff 0: classical gemm
+static double best_of(int runs, int cutoff, const struct matrix *a,
+		      const struct matrix *b)
+{
+	double best = 1e30;
+	for (int r = 0; r < runs; r++) {
+		struct matrix c;
+		mat_alloc(&c, a->rows, b->cols);
+		double t = now();
+		if (cutoff)
+			strassen(&c, a, b, cutoff);
+		else
+			gemm(&c, a, b);
+		t = now() - t;
+		best = t < best ? t : best;
+		mat_free(&c);
+	}
+	return best;
+}
+
+static void bench(int runs, int m, int k, int n)
+{
+	struct matrix a, b;
+	char shape[32];
+
+	fill(&a, m, k, 1000);
+	fill(&b, k, n, 1000);
+	snprintf(shape, sizeof(shape), "%dx%dx%d", m, k, n);
+	double classical = best_of(runs, 0, &a, &b);
+	printf("%-16s %9.1f", shape, classical * 1e3);
+	for (int i = 0; i < NUM_CUTOFFS; i++) {
+		double t = best_of(runs, cutoffs[i], &a, &b);
+		printf(" %7.1f %4.2fx", t * 1e3, classical / t);
+	}
+	printf("\n");
+	fflush(stdout);
+	mat_free(&a);
+	mat_free(&b);
+}
+
+int main(int argc, char *argv[])
+{
+	static const int shapes[][4] = {
+		// m, k, n, cutoff
+		{ 1, 1, 1, 16 },      { 33, 65, 17, 16 },   { 64, 64, 64, 16 },
+		{ 97, 300, 33, 16 },  { 200, 129, 301, 32 }, { 255, 255, 255, 31 },
+		{ 512, 512, 512, 64 }, { 1234, 250, 1234, 64 },
+	};
+	int nshapes = sizeof(shapes) / sizeof(shapes[0]);
+	int runs = argc > 1 ? atoi(argv[1]) : 3;
+	int max = argc > 2 ? atoi(argv[2]) : 2048;
+	int failed = 0;
+
+	srand(1);
+	printf("kernel: %s\n", gemm_select()->name);
+	for (int s = 0; s < nshapes; s++)
+		for (int range = 0; range <= 1000; range += 1000)
+			failed |= check(shapes[s][0], shapes[s][1],
+					shapes[s][2], shapes[s][3], range);
+	printf("strassen %s\n",
+	       failed ? "MISMATCH against gemm" : "matches gemm");
+
+	printf("\nbest of %d, ms and speedup over gemm\n", runs);
+	printf("%-16s %9s", "m x k x n", "gemm");
+	for (int i = 0; i < NUM_CUTOFFS; i++)
+		printf("   cutoff %-4d", cutoffs[i]);
+	printf("\n");
+	for (int size = 256; size <= max; size *= 2) {
+		bench(runs, size, size, size);
+		if (size * 3 / 2 <= max)
+			bench(runs, size * 3 / 2, size * 3 / 2, size * 3 / 2);
+	}
+	bench(runs, 1234, 250, 1234);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,72 @@
+#ifndef THREAD_STATS_H
+#define THREAD_STATS_H
+
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Per-thread scheduling statistics from My_Kernel's proc file, one line
+ * per thread of the reading process:
+ *
+ *   PID: p, TID: t, Priority: n, State: s, CPU: c, migrations: m,
+ *   utime: us, stime: us, nvcsw: n, nivcsw: n, wait: us, runs: n
+ *
+ * thread_stats_table() prints them as a table, one row per worker; the
+ * worker threads have to be alive while the file is read.
+ */
+
+struct thread_stat {
+	int pid, tid, prio, state, cpu;
+	unsigned long long migrations, utime, stime;
+	unsigned long nvcsw, nivcsw;
+	unsigned long long wait;
+	unsigned long runs;
+};
+
+/* Return 1 if line is a thread's line, 0 if it is something else */
+static inline int thread_stat_parse(struct thread_stat *s, const char *line)
+{
+	return sscanf(line,
+		      "PID: %d, TID: %d, Priority: %d, State: %d, CPU: %d, "
+		      "migrations: %llu, utime: %llu, stime: %llu, "
+		      "nvcsw: %lu, nivcsw: %lu, wait: %llu, runs: %lu",
+		      &s->pid, &s->tid, &s->prio, &s->state, &s->cpu,
+		      &s->migrations, &s->utime, &s->stime, &s->nvcsw,
+		      &s->nivcsw, &s->wait, &s->runs) == 12;
+}
+
+/*
+ * Read path and print a row per thread to out. Lines in another format
+ * (an older module) are printed as they are. Return the number of
+ * threads, or -1 if path cannot be read.
+ */
+static inline int thread_stats_table(FILE *out, const char *path)
+{
+	FILE *f = fopen(path, "r");
+	char line[512];
+	int n = 0;
+
+	if (f == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		struct thread_stat s;
+		if (!thread_stat_parse(&s, line)) {
+			fputs(line, out);
+			continue;
+		}
+		if (n++ == 0)
+			fprintf(out,
+				"%8s %4s %4s %5s %10s %10s %7s %7s %10s %7s\n",
+				"TID", "CPU", "prio", "migr", "user ms",
+				"sys ms", "vcsw", "ivcsw", "wait ms", "runs");
+		fprintf(out,
+			"%8d %4d %4d %5llu %10.3f %10.3f %7lu %7lu %10.3f "
+			"%7lu\n",
+			s.tid, s.cpu, s.prio, s.migrations, s.utime / 1e3,
+			s.stime / 1e3, s.nvcsw, s.nivcsw, s.wait / 1e3, s.runs);
+	}
+	fclose(f);
+	return n;
+}
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef CLH_H
+#define CLH_H
+
+#include <stdlib.h>
+#include "lock.h"
+
+/*
+ * CLH lock: an implicit queue, each waiter spins on the node of its
+ * predecessor. Releasing clears the caller's node, which the successor
+ * is watching, and the caller takes over the predecessor's node, so
+ * there is no successor pointer to wait for
+ */
+
+struct clh_lock {
+	_Atomic(struct qnode *) tail;
+	struct qnode *dummy; // initial tail, owned by whoever holds it
+} __attribute__((aligned(LOCK_CACHE_LINE)));
+
+static inline void clh_init(struct clh_lock *l)
+{
+	l->dummy = aligned_alloc(LOCK_CACHE_LINE, sizeof(struct qnode));
+	atomic_init(&l->dummy->locked, false);
+	atomic_init(&l->tail, l->dummy);
+}
+
+static inline void clh_acquire(struct clh_lock *l, struct qnode *me)
+{
+	atomic_store_explicit(&me->locked, true, memory_order_relaxed);
+	struct qnode *pred =
+		atomic_exchange_explicit(&l->tail, me, memory_order_acq_rel);
+	me->prev = pred;
+	while (atomic_load_explicit(&pred->locked, memory_order_acquire))
+		cpu_relax();
+}
+
+/**
+ * Return the node the caller owns from now on
+ */
+static inline struct qnode *clh_release(struct clh_lock *l, struct qnode *me)
+{
+	struct qnode *pred = me->prev;
+	atomic_store_explicit(&me->locked, false, memory_order_release);
+	return pred;
+}
+
+static inline void *clh_create()
+{
+	struct clh_lock *l = aligned_alloc(LOCK_CACHE_LINE, sizeof(*l));
+	clh_init(l);
+	return l;
+}
+
+/*
+ * The node left in the tail belongs to the lock: it is the dummy or a
+ * thread's node that was swapped for the dummy, so one node is freed
+ * either way. Callers free the nodes they hold after their last release.
+ */
+static inline void clh_destroy(void *l)
+{
+	free(atomic_load(&((struct clh_lock *)l)->tail));
+	free(l);
+}
+
+static inline void clh_acquire_node(void *l, struct qnode **node)
+{
+	clh_acquire((struct clh_lock *)l, *node);
+}
+
+static inline void clh_release_node(void *l, struct qnode **node)
+{
+	*node = clh_release((struct clh_lock *)l, *node);
+}
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef LOCK_H
+#define LOCK_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/*
+ * Common interface of the queue locks
+ *
+ * Every lock is acquired and released with the caller's queue node.
+ * The ticket lock ignores it, MCS links it into the queue, CLH hands it
+ * over to the next waiter and gives the caller its predecessor's node
+ * in exchange, so a thread must always pass the node it got back.
+ */
+
+#define LOCK_CACHE_LINE 64
+
+struct qnode {
+	_Atomic(struct qnode *) next; // MCS successor
+	struct qnode *prev; // CLH predecessor, recycled on release
+	atomic_bool locked;
+} __attribute__((aligned(LOCK_CACHE_LINE)));
+
+struct lock_type {
+	const char *name;
+	void *(*create)();
+	void (*destroy)(void *lock);
+	void (*acquire)(void *lock, struct qnode **node);
+	void (*release)(void *lock, struct qnode **node);
+};
+
+static inline void cpu_relax()
+{
+	__builtin_ia32_pause();
+}
+
+#endif
@@ -0,0 +1,267 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "ticket.h"
+#include "mcs.h"
+#include "clh.h"
+#include "../1/spin.h"
+
+/*
+ * Lock harness
+ *
+ * Threads pinned round-robin to the cores take the lock in a loop for
+ * a fixed time, with a short critical section and a short pause
+ * between acquisitions. For every lock and thread count it reports:
+ *   Mops/s          acquisitions per second, all threads
+ *   p50/p99/p999    time spent in acquire(), log-linear histogram
+ *   max             longest single acquire()
+ *   jain            Jain's index of the per-thread acquisitions
+ *   starve_ms       longest time any thread went between two of its
+ *                   acquisitions
+ *
+ * usage: lock_bench [max_threads] [ms_per_run]
+ */
+
+#define MAX_THREADS 256
+#define HIST_SUB_BITS 2
+#define HIST_BUCKETS (64 << HIST_SUB_BITS)
+#define CS_PAUSES 8 // work inside the critical section
+#define OUTSIDE_PAUSES 32 // work between two acquisitions
+
+struct worker {
+	pthread_t tid;
+	struct qnode *node;
+	long ops;
+	long max_gap;
+	long hist[HIST_BUCKETS];
+} __attribute__((aligned(LOCK_CACHE_LINE)));
+
+static const struct lock_type *type;
+static void *lock;
+static volatile long shared;
+static volatile bool stop;
+static pthread_barrier_t start;
+static int ncpus;
+
+static void *spin_create()
+{
+	pthread_spinlock_t *l = malloc(sizeof(*l));
+	pthread_spin_init(l, 0);
+	return (void *)l;
+}
+
+static void spin_destroy(void *l)
+{
+	pthread_spin_destroy(l);
+	free(l);
+}
+
+static void spin_acquire(void *l, struct qnode **node)
+{
+	pthread_spin_lock(l);
+}
+
+static void spin_release(void *l, struct qnode **node)
+{
+	pthread_spin_unlock(l);
+}
+
+static void *ttas_create()
+{
+	int *l = malloc(sizeof(*l));
+	*l = 1;
+	return (void *)l;
+}
+
+static void ttas_acquire(void *l, struct qnode **node)
+{
+	ttas_spin_lock(l);
+}
+
+static void ttas_release(void *l, struct qnode **node)
+{
+	spin_unlock_store(l);
+}
+
+static void *mutex_create()
+{
+	pthread_mutex_t *l = malloc(sizeof(*l));
+	pthread_mutex_init(l, NULL);
+	return (void *)l;
+}
+
+static void mutex_destroy(void *l)
+{
+	pthread_mutex_destroy(l);
+	free(l);
+}
+
+static void mutex_acquire(void *l, struct qnode **node)
+{
+	pthread_mutex_lock(l);
+}
+
+static void mutex_release(void *l, struct qnode **node)
+{
+	pthread_mutex_unlock(l);
+}
+
+static const struct lock_type types[] = {
+	{ "ticket", ticket_create, free, ticket_acquire_node,
+	  ticket_release_node },
+	{ "mcs", mcs_create, free, mcs_acquire_node, mcs_release_node },
+	{ "clh", clh_create, clh_destroy, clh_acquire_node, clh_release_node },
+	{ "pthread_spin", spin_create, spin_destroy, spin_acquire,
+	  spin_release },
+	{ "ttas_backoff", ttas_create, free, ttas_acquire, ttas_release },
+	{ "mutex", mutex_create, mutex_destroy, mutex_acquire, mutex_release },
+};
+
+static inline long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static int bucket_of(unsigned long v)
+{
+	if (v < (1 << HIST_SUB_BITS))
+		return v;
+	int msb = 63 - __builtin_clzl(v);
+	return ((msb - HIST_SUB_BITS + 1) << HIST_SUB_BITS) +
+	       ((v >> (msb - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1));
+}
+
+// smallest value of the bucket
+static unsigned long bucket_low(int b)
+{
+	if (b < (1 << HIST_SUB_BITS))
+		return b;
+	int msb = (b >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+	unsigned long sub = b & ((1 << HIST_SUB_BITS) - 1);
+	return ((1UL << HIST_SUB_BITS) | sub) << (msb - HIST_SUB_BITS);
+}
+
+static inline void pauses(int n)
+{
+	for (int i = 0; i < n; ++i)
+		cpu_relax();
+}
+
+static void *worker(void *arg)
+{
+	struct worker *w = (struct worker *)arg;
+	long ops = 0, max_gap = 0;
+
+	pthread_barrier_wait(&start);
+	long last = now_ns();
+	while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+		long t0 = now_ns();
+		type->acquire(lock, &w->node);
+		long t1 = now_ns();
+		shared = shared + 1;
+		pauses(CS_PAUSES);
+		type->release(lock, &w->node);
+
+		++w->hist[bucket_of(t1 - t0)];
+		if (t1 - last > max_gap)
+			max_gap = t1 - last;
+		last = t1;
+		++ops;
+		pauses(OUTSIDE_PAUSES);
+	}
+	w->ops = ops;
+	w->max_gap = max_gap;
+	return NULL;
+}
+
+static unsigned long percentile(const long *hist, long total, double p)
+{
+	long want = total * p, seen = 0;
+	for (int b = 0; b < HIST_BUCKETS; ++b)
+		if ((seen += hist[b]) > want)
+			return bucket_low(b);
+	return 0;
+}
+
+static void run(const struct lock_type *t, int n, int ms)
+{
+	struct worker *w = aligned_alloc(LOCK_CACHE_LINE, n * sizeof(*w));
+	static long hist[HIST_BUCKETS];
+	long total = 0, max_gap = 0;
+	double sum_sq = 0;
+	int max_bucket = 0;
+
+	type = t;
+	lock = t->create();
+	shared = 0;
+	stop = false;
+	memset(w, 0, n * sizeof(*w));
+	memset(hist, 0, sizeof(hist));
+	pthread_barrier_init(&start, NULL, n + 1);
+	for (int i = 0; i < n; ++i) {
+		cpu_set_t set;
+		w[i].node = aligned_alloc(LOCK_CACHE_LINE, sizeof(struct qnode));
+		memset(w[i].node, 0, sizeof(struct qnode));
+		pthread_create(&w[i].tid, NULL, worker, &w[i]);
+		CPU_ZERO(&set);
+		CPU_SET(i % ncpus, &set);
+		pthread_setaffinity_np(w[i].tid, sizeof(set), &set);
+	}
+	pthread_barrier_wait(&start);
+	long t0 = now_ns();
+	usleep(ms * 1000);
+	__atomic_store_n(&stop, true, __ATOMIC_RELAXED);
+	for (int i = 0; i < n; ++i)
+		pthread_join(w[i].tid, NULL);
+	double elapsed = (now_ns() - t0) / 1e9;
+	pthread_barrier_destroy(&start);
+
+	for (int i = 0; i < n; ++i) {
+		total += w[i].ops;
+		sum_sq += (double)w[i].ops * w[i].ops;
+		if (w[i].max_gap > max_gap)
+			max_gap = w[i].max_gap;
+		for (int b = 0; b < HIST_BUCKETS; ++b) {
+			hist[b] += w[i].hist[b];
+			if (w[i].hist[b] && b > max_bucket)
+				max_bucket = b;
+		}
+		free(w[i].node);
+	}
+	t->destroy(lock);
+
+	printf("%-13s %7d %9.2f %8lu %8lu %8lu %10lu %6.3f %10.3f%s\n",
+	       t->name, n, total / elapsed / 1e6,
+	       percentile(hist, total, 0.5), percentile(hist, total, 0.99),
+	       percentile(hist, total, 0.999), bucket_low(max_bucket),
+	       sum_sq > 0 ? (double)total * total / (n * sum_sq) : 0,
+	       max_gap / 1e6, shared == total ? "" : "  LOST UPDATES");
+	free(w);
+}
+
+int main(int argc, char *argv[])
+{
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int max_threads = argc > 1 ? atoi(argv[1]) : ncpus;
+	int ms = argc > 2 ? atoi(argv[2]) : 200;
+	if (max_threads < 1 || max_threads > MAX_THREADS) {
+		fprintf(stderr, "max_threads must be 1..%d\n", MAX_THREADS);
+		return 1;
+	}
+
+	printf("%-13s %7s %9s %8s %8s %8s %10s %6s %10s\n", "lock", "threads",
+	       "Mops/s", "p50_ns", "p99_ns", "p999_ns", "max_ns", "jain",
+	       "starve_ms");
+	for (int i = 0; i < sizeof(types) / sizeof(types[0]); ++i)
+		for (int n = 1; n <= max_threads; ++n)
+			run(&types[i], n, ms);
+	return 0;
+}
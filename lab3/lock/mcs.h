@@ -0,0 +1,70 @@
+#ifndef MCS_H
+#define MCS_H
+
+#include <stdlib.h>
+#include "lock.h"
+
+/*
+ * MCS lock: waiters form a linked queue and each one spins on the
+ * "locked" flag of its own node, so a release touches only the
+ * successor's cache line
+ */
+
+struct mcs_lock {
+	_Atomic(struct qnode *) tail;
+} __attribute__((aligned(LOCK_CACHE_LINE)));
+
+static inline void mcs_init(struct mcs_lock *l)
+{
+	atomic_init(&l->tail, NULL);
+}
+
+static inline void mcs_acquire(struct mcs_lock *l, struct qnode *me)
+{
+	atomic_store_explicit(&me->next, NULL, memory_order_relaxed);
+	atomic_store_explicit(&me->locked, true, memory_order_relaxed);
+	struct qnode *pred =
+		atomic_exchange_explicit(&l->tail, me, memory_order_acq_rel);
+	if (pred == NULL)
+		return;
+	atomic_store_explicit(&pred->next, me, memory_order_release);
+	while (atomic_load_explicit(&me->locked, memory_order_acquire))
+		cpu_relax();
+}
+
+static inline void mcs_release(struct mcs_lock *l, struct qnode *me)
+{
+	struct qnode *next =
+		atomic_load_explicit(&me->next, memory_order_acquire);
+	if (next == NULL) {
+		struct qnode *expected = me;
+		if (atomic_compare_exchange_strong_explicit(
+			    &l->tail, &expected, NULL, memory_order_release,
+			    memory_order_relaxed))
+			return;
+		// a waiter swapped the tail but has not linked itself yet
+		while ((next = atomic_load_explicit(
+				&me->next, memory_order_acquire)) == NULL)
+			cpu_relax();
+	}
+	atomic_store_explicit(&next->locked, false, memory_order_release);
+}
+
+static inline void *mcs_create()
+{
+	struct mcs_lock *l = aligned_alloc(LOCK_CACHE_LINE, sizeof(*l));
+	mcs_init(l);
+	return l;
+}
+
+static inline void mcs_acquire_node(void *l, struct qnode **node)
+{
+	mcs_acquire((struct mcs_lock *)l, *node);
+}
+
+static inline void mcs_release_node(void *l, struct qnode **node)
+{
+	mcs_release((struct mcs_lock *)l, *node);
+}
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef TICKET_H
+#define TICKET_H
+
+#include <stdlib.h>
+#include "lock.h"
+
+/*
+ * Ticket lock: FIFO through two counters, every waiter spins on the
+ * same "owner" line, which is invalidated in all of them on release
+ */
+
+struct ticket_lock {
+	atomic_uint next;
+	char pad[LOCK_CACHE_LINE - sizeof(atomic_uint)];
+	atomic_uint owner;
+} __attribute__((aligned(LOCK_CACHE_LINE)));
+
+static inline void ticket_init(struct ticket_lock *l)
+{
+	atomic_init(&l->next, 0);
+	atomic_init(&l->owner, 0);
+}
+
+static inline void ticket_acquire(struct ticket_lock *l)
+{
+	unsigned int me = atomic_fetch_add_explicit(&l->next, 1,
+						    memory_order_relaxed);
+	while (atomic_load_explicit(&l->owner, memory_order_acquire) != me)
+		cpu_relax();
+}
+
+static inline void ticket_release(struct ticket_lock *l)
+{
+	// only the holder writes owner
+	unsigned int owner =
+		atomic_load_explicit(&l->owner, memory_order_relaxed);
+	atomic_store_explicit(&l->owner, owner + 1, memory_order_release);
+}
+
+static inline void *ticket_create()
+{
+	struct ticket_lock *l = aligned_alloc(LOCK_CACHE_LINE, sizeof(*l));
+	ticket_init(l);
+	return l;
+}
+
+static inline void ticket_acquire_node(void *l, struct qnode **node)
+{
+	ticket_acquire((struct ticket_lock *)l);
+}
+
+static inline void ticket_release_node(void *l, struct qnode **node)
+{
+	ticket_release((struct ticket_lock *)l);
+}
+
+#endif